@@ -0,0 +1,341 @@
+// bmjap-analyze
+//
+// Runs the same pitch/levels/envelope chain as the app over a directory of
+// Ogg files, without a GUI or audio device and without real-time pacing.
+// Files are shared out over one worker thread per core.
+//
+//   bmjap-analyze [-j num_workers] [-o output_dir] [-d] [-r min_hz:max_hz]
+//                 [-m acf|mpm|yin] [-D 1|2|4|8] [-w wisdom_dir [-P]] input_dir
+//
+// -r limits the pitch search to a frequency range, e.g. -r 60:1000 for voice
+//    (0 < min_hz < max_hz).
+// -m picks the pitch detector, plain autocorrelation (default), MPM or YIN
+//    (the sliding yin_pitch detector, which ignores -D and -d).
+// -D decimates by 2, 4 or 8 before the autocorrelation (with -r, keep the
+//    top of the range under 0.4 * sample rate / factor).
+// -d runs the autocorrelation in double instead of single precision.
+// -w keeps FFTW planner wisdom in wisdom_dir between runs, and -P builds it
+//    up front with FFTW_PATIENT for the common sample rates.
+//
+// For every file a summary line is written to stdout. When an output
+// directory is given, the per-window results are also written to
+// <output_dir>/<file name>.txt as tab separated columns:
+//
+//   start_count  frequency  confidence  note  level  envelope_active
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "load_audio_file.hpp"
+#include "pitch_detect.hpp"
+#include "yin_pitch.hpp"
+#include "levels.hpp"
+#include "envelope_detect.hpp"
+
+constexpr double WINDOW_TIME = 0.025;
+
+static std::vector<std::string> file_names;
+static std::string input_dir;
+static std::string output_dir;
+static FFTPrecision precision = FFT_PRECISION_FLOAT;
+static double min_frequency = 0.0;
+static double max_frequency = 0.0;
+static PitchDetectMethod method = PITCH_DETECT_AUTOCORRELATION;
+static bool use_yin = false; // yin_pitch instead of pitch_detect
+static int decimation = 1;
+static std::atomic_int next_file;
+
+static std::mutex output_mutex;
+static std::atomic_long total_samples;
+
+struct AnalyzeWorker {
+    pthread_t thread;
+    int sample_rate;
+    int window_length;
+    PitchDetectState pd_state; // unless use_yin
+    YinPitchState yin_state;   // if use_yin
+    LevelsState lvl_state;
+    EnvelopeDetectState env_state;
+};
+
+static void worker_destroy_states(AnalyzeWorker* worker) {
+    if (use_yin) {
+        yin_pitch_destroy(&worker->yin_state);
+    } else {
+        pitch_detect_destroy(&worker->pd_state);
+    }
+    levels_destroy(&worker->lvl_state);
+}
+
+static void worker_set_sample_rate(AnalyzeWorker* worker, int sample_rate) {
+    if (worker->sample_rate == sample_rate) {
+        return;
+    }
+    if (worker->sample_rate != 0) {
+        worker_destroy_states(worker);
+    }
+    worker->sample_rate = sample_rate;
+    if (use_yin) {
+        yin_pitch_init(&worker->yin_state, WINDOW_TIME, sample_rate, min_frequency, max_frequency);
+        worker->window_length = worker->yin_state.window_length;
+    } else {
+        pitch_detect_init_state(&worker->pd_state, WINDOW_TIME, sample_rate, min_frequency, max_frequency, precision, method, decimation);
+        worker->window_length = worker->pd_state.window_length;
+    }
+    levels_init(&worker->lvl_state, sample_rate, DECAY_TIME, worker->window_length);
+}
+
+static void analyze_file(AnalyzeWorker* worker, const std::string& file_name) {
+    auto in_path = input_dir + "/" + file_name;
+
+    AudioAsset asset;
+    if (!load_audio_file(in_path.c_str(), &asset)) {
+        std::lock_guard<std::mutex> lg(output_mutex);
+        fprintf(stderr, "%s: failed to decode\n", file_name.c_str());
+        return;
+    }
+
+    worker_set_sample_rate(worker, asset.sample_rate);
+    worker->lvl_state.level = 0.0;
+    envelope_detect_init(&worker->env_state);
+    if (use_yin) {
+        yin_pitch_reset(&worker->yin_state);
+        worker->yin_state.end_count = 0;
+    }
+
+    FILE* out = NULL;
+    if (!output_dir.empty()) {
+        auto out_path = output_dir + "/" + file_name + ".txt";
+        out = fopen(out_path.c_str(), "w");
+        if (!out) {
+            std::lock_guard<std::mutex> lg(output_mutex);
+            fprintf(stderr, "%s: failed to open %s\n", file_name.c_str(), out_path.c_str());
+        }
+    }
+
+    auto window_length = worker->window_length;
+    auto num_samples = asset.left.num_samples();
+    int num_windows = 0;
+    int num_voiced = 0;
+    int num_envelopes = 0;
+
+    // Feed the file through the chain window by window, like window_reader does
+    for (long count = 0; count + window_length <= num_samples; count += window_length) {
+        auto window = asset.left + (int)count;
+        window.end = window.ptr + window_length * window.step;
+
+        PitchDetectResult result;
+        Area ac_area, lvl_area;
+        levels_compute(&worker->lvl_state, window, &lvl_area);
+        if (use_yin) {
+            yin_pitch_detect(&worker->yin_state, window, count, &ac_area, &result);
+        } else {
+            pitch_detect_compute(&worker->pd_state, window, &ac_area, &result);
+        }
+
+        auto envelope_active_pre = worker->env_state.envelope_active;
+        envelope_detect_compute(&worker->env_state, asset.sample_rate, count, lvl_area, result.confidence);
+
+        ++num_windows;
+        if (result.confidence > 0.5) {
+            ++num_voiced;
+        }
+        if (!envelope_active_pre && worker->env_state.envelope_active) {
+            ++num_envelopes;
+        }
+
+        if (out) {
+            fprintf(
+                out,
+                "%ld\t%f\t%f\t%s%d%+d\t%f\t%d\n",
+                count,
+                result.frequency,
+                result.confidence,
+                result.note_name,
+                (int)result.note_octave,
+                (int)result.note_cents,
+                *(lvl_area.end - 1),
+                (int)worker->env_state.envelope_active
+            );
+        }
+    }
+
+    if (out) {
+        fclose(out);
+    }
+    destroy_audio_asset(&asset);
+
+    total_samples += num_samples;
+
+    std::lock_guard<std::mutex> lg(output_mutex);
+    printf(
+        "%s\t%.3fs\twindows=%d\tvoiced=%d\tenvelopes=%d\n",
+        file_name.c_str(),
+        num_samples / (double)asset.sample_rate,
+        num_windows,
+        num_voiced,
+        num_envelopes
+    );
+}
+
+static void* analyze_thread(void* ptr) {
+    auto worker = (AnalyzeWorker*)ptr;
+    worker->sample_rate = 0;
+
+    while (true) {
+        auto i = next_file++;
+        if (i >= (int)file_names.size()) {
+            break;
+        }
+        analyze_file(worker, file_names[i]);
+    }
+
+    if (worker->sample_rate != 0) {
+        worker_destroy_states(worker);
+    }
+
+    return NULL;
+}
+
+static bool has_ogg_extension(const char* name) {
+    auto len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".ogg") == 0;
+}
+
+static void print_usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-j num_workers] [-o output_dir] [-d] [-r min_hz:max_hz] [-m acf|mpm|yin] [-D 1|2|4|8] [-w wisdom_dir [-P]] input_dir\n", argv0);
+}
+
+int main(int argc, char** argv) {
+
+    int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* wisdom_dir = NULL;
+    bool prewarm = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:o:dr:m:D:w:P")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_workers = atoi(optarg);
+                break;
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'd':
+                precision = FFT_PRECISION_DOUBLE;
+                break;
+            case 'r':
+                if (sscanf(optarg, "%lf:%lf", &min_frequency, &max_frequency) != 2 || !(min_frequency > 0.0 && min_frequency < max_frequency)) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "mpm") == 0) {
+                    method = PITCH_DETECT_MPM;
+                    use_yin = false;
+                } else if (strcmp(optarg, "acf") == 0) {
+                    method = PITCH_DETECT_AUTOCORRELATION;
+                    use_yin = false;
+                } else if (strcmp(optarg, "yin") == 0) {
+                    use_yin = true;
+                } else {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'D':
+                decimation = atoi(optarg);
+                if (decimation != 1 && decimation != 2 && decimation != 4 && decimation != 8) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                wisdom_dir = optarg;
+                break;
+            case 'P':
+                prewarm = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    input_dir = argv[optind];
+
+    if (wisdom_dir) {
+        fft_wisdom_set_cache(wisdom_dir);
+        if (prewarm) {
+            const int window_lengths[] = {
+                (int)(WINDOW_TIME * 44100) / decimation,
+                (int)(WINDOW_TIME * 48000) / decimation,
+            };
+            fft_wisdom_prewarm(window_lengths, 2, precision);
+        }
+    }
+
+    // Collect the input files
+    {
+        auto dir = opendir(input_dir.c_str());
+        if (!dir) {
+            fprintf(stderr, "Failed to open directory %s\n", input_dir.c_str());
+            return 1;
+        }
+        while (auto entry = readdir(dir)) {
+            if (has_ogg_extension(entry->d_name)) {
+                file_names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(file_names.begin(), file_names.end());
+    }
+
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    if (num_workers > (int)file_names.size()) {
+        num_workers = (int)file_names.size();
+    }
+
+    auto time_start = std::chrono::steady_clock::now();
+
+    next_file = 0;
+    total_samples = 0;
+    std::vector<AnalyzeWorker> workers(num_workers);
+    for (auto& worker : workers) {
+        pthread_create(&worker.thread, NULL, analyze_thread, &worker);
+    }
+    for (auto& worker : workers) {
+        pthread_join(worker.thread, NULL);
+    }
+
+    auto time_end = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>(time_end - time_start).count();
+
+    fprintf(
+        stderr,
+        "Analyzed %d files (%ld samples) in %.3fs with %d workers\n",
+        (int)file_names.size(),
+        total_samples.load(),
+        elapsed,
+        num_workers
+    );
+
+    return 0;
+}
@@ -13,7 +13,6 @@ static WriteCallback app_write_callback;
 
 static PaStream *pa_stream;
 
-constexpr int BUFFER_SIZE = 32;
 constexpr int SAMPLE_RATE = 44100;
 constexpr int NUM_IN_CHANNELS = 1;
 constexpr int NUM_OUT_CHANNELS = 2;
@@ -49,7 +48,6 @@ int init_audio_client(int sample_rate, ReadCallback read_callback_, WriteCallbac
     app_write_callback = std::move(write_callback_);
 
     char *stream_name = NULL;
-    double latency = (double)BUFFER_SIZE / sample_rate;
 
     PaError err;
     err = Pa_Initialize();
@@ -65,7 +63,7 @@ int init_audio_client(int sample_rate, ReadCallback read_callback_, WriteCallbac
         NUM_OUT_CHANNELS,          /* no output channels */
         paFloat32,  /* 32 bit floating point output */
         SAMPLE_RATE,
-        BUFFER_SIZE,
+        paFramesPerBufferUnspecified, /* let the host pick its block size */
         patestCallback, /* this is your callback function */
         NULL); /* This is a pointer that will be passed to your callback*/
     if (err != paNoError) {
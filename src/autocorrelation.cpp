@@ -0,0 +1,98 @@
+#include "autocorrelation.hpp"
+#include "kernels.hpp"
+#include <cmath>
+
+// Relative cost of one direct multiply-add versus one point of a real FFT
+// (per point per log2 N, covering both transforms), plus the passes over
+// the padded buffer that the FFT path makes (copy, pad, square, scale)
+constexpr double COST_DIRECT_PER_MAC = 1.0;
+constexpr double COST_FFT_PER_POINT_LOG = 1.25;
+constexpr double COST_FFT_PER_POINT = 4.0;
+
+static AutocorrelationMethod choose_method(int window_length, int min_lag, int max_lag) {
+    double num_macs = 0.0;
+    for (int lag = min_lag; lag <= max_lag; ++lag) {
+        num_macs += window_length - lag;
+    }
+    auto direct_cost = COST_DIRECT_PER_MAC * num_macs;
+
+    double N = fft_transform_size(window_length);
+    auto fft_cost = COST_FFT_PER_POINT_LOG * N * log2(N) + COST_FFT_PER_POINT * N;
+
+    return direct_cost < fft_cost ? AUTOCORRELATION_DIRECT : AUTOCORRELATION_FFT;
+}
+
+void autocorrelation_init(AutocorrelationState* state, int window_length, int min_lag, int max_lag, FFTPrecision precision, AutocorrelationMethod method) {
+
+    if (min_lag < 1) {
+        min_lag = 1;
+    }
+    if (max_lag > window_length - 1) {
+        max_lag = window_length - 1;
+    }
+
+    state->window_length = window_length;
+    state->min_lag = min_lag;
+    state->max_lag = max_lag;
+
+    if (method == AUTOCORRELATION_AUTO) {
+        method = choose_method(window_length, min_lag, max_lag);
+    }
+    state->method = method;
+
+    if (method == AUTOCORRELATION_FFT) {
+        state->fft_state = fft_init(window_length, precision);
+        state->window = nullptr;
+    } else {
+        state->fft_state = nullptr;
+        state->window = new float[window_length];
+    }
+}
+
+static void compute_direct(AutocorrelationState* state, Area in, Area out) {
+
+    // ... gather the window into contiguous memory for the dot products
+    auto n = Area::copy_over(in, Area(state->window, state->window_length, 1));
+    auto x = state->window;
+
+    // ... clear the lags we don't compute
+    {
+        auto ptr = out;
+        while (ptr < ptr.end) {
+            *ptr++ = 0.0;
+        }
+    }
+
+    auto energy = dot_product(x, x, n);
+    if (energy <= 0.0f) {
+        return;
+    }
+
+    *out = 1.0;
+
+    auto num_out = out.num_samples();
+    auto max_lag = state->max_lag < num_out - 1 ? state->max_lag : num_out - 1;
+    auto scalar = 1.0f / energy;
+    for (int lag = state->min_lag; lag <= max_lag && lag < n; ++lag) {
+        *(out + lag) = dot_product(x, x + lag, n - lag) * scalar;
+    }
+}
+
+void autocorrelation_compute(AutocorrelationState* state, Area in, Area out) {
+    if (state->method == AUTOCORRELATION_FFT) {
+        fft_compute(state->fft_state, in, out);
+    } else {
+        compute_direct(state, in, out);
+    }
+}
+
+float autocorrelation_lag(const float* x, int n, int lag) {
+    return lag < n ? dot_product(x, x + lag, n - lag) : 0.0f;
+}
+
+void autocorrelation_destroy(AutocorrelationState* state) {
+    if (state->fft_state) {
+        fft_destroy(state->fft_state);
+    }
+    delete[] state->window;
+}
@@ -0,0 +1,36 @@
+#ifndef autocorrelation_hpp
+#define autocorrelation_hpp
+
+#include "fft.hpp"
+
+// How the autocorrelation is computed. AUTO picks whichever of the two is
+// cheaper for the window length and lag range.
+enum AutocorrelationMethod {
+    AUTOCORRELATION_AUTO,
+    AUTOCORRELATION_DIRECT, // time domain dot products over the requested lags
+    AUTOCORRELATION_FFT     // forward/backward FFT over every lag
+};
+
+struct AutocorrelationState {
+    int window_length;
+    int min_lag;
+    int max_lag;
+    AutocorrelationMethod method; // DIRECT or FFT once initialised
+
+    FFTState* fft_state;
+    float* window;
+};
+
+void autocorrelation_init(AutocorrelationState* state, int window_length, int min_lag, int max_lag, FFTPrecision precision = FFT_PRECISION_FLOAT, AutocorrelationMethod method = AUTOCORRELATION_AUTO);
+
+// Writes the linear autocorrelation of in, normalised so lag 0 is 1.0, to
+// out (one sample per lag). Only lag 0 and min_lag...max_lag are guaranteed
+// to be computed; the other lags may be written as 0.
+void autocorrelation_compute(AutocorrelationState* state, Area in, Area out);
+void autocorrelation_destroy(AutocorrelationState* state);
+
+// The unnormalised autocorrelation of n contiguous samples at one lag, for
+// refining a few lags without computing the rest
+float autocorrelation_lag(const float* x, int n, int lag);
+
+#endif
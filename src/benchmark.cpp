@@ -0,0 +1,504 @@
+// bmjap-bench
+//
+// Microbenchmarks for the hot loops of the analysis engine. Every kernel is
+// fed deterministic synthetic input and timed until it has run for at least
+// the minimum time. Results are written to stdout as JSON:
+//
+//   { "benchmarks": [ { "name": ..., "params": { ... }, "iterations": ...,
+//                       "ns_per_call": ..., "samples_per_sec": ... }, ... ] }
+//
+//   bmjap-bench [-t min_time_seconds] [-f name_filter]
+
+#include <chrono>
+#include <string>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fft.hpp"
+#include "autocorrelation.hpp"
+#include "pitch_detect.hpp"
+#include "yin_pitch.hpp"
+#include "poly_pitch.hpp"
+#include "pitch_track.hpp"
+#include "levels.hpp"
+#include "envelope_detect.hpp"
+#include "peak_render.hpp"
+#include "data_types/Area.hpp"
+#include "data_types/ring_buffer.hpp"
+
+constexpr int SAMPLE_RATE = 44100;
+
+static double min_time = 0.25;
+static const char* name_filter = NULL;
+static bool first_result = true;
+
+// Keeps the optimiser from discarding the benchmarked work
+static volatile float sink;
+
+static void fill_signal(float* data, int num_samples) {
+    unsigned int seed = 12345;
+    for (int i = 0; i < num_samples; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        auto noise = (float)((seed >> 8) / 8388608.0 - 1.0);
+        auto t = (double)i / SAMPLE_RATE;
+        data[i] = (float)(0.5 * sin(2.0 * M_PI * 220.0 * t) + 0.25 * sin(2.0 * M_PI * 660.0 * t) + 0.05 * noise);
+    }
+}
+
+static bool should_run(const char* name) {
+    return !name_filter || strstr(name, name_filter);
+}
+
+template <typename F>
+static void run_benchmark(const char* name, const char* params, long samples_per_call, F&& fn) {
+    if (!should_run(name)) {
+        return;
+    }
+
+    typedef std::chrono::steady_clock clock;
+
+    // Warm up caches and lazily allocated state
+    fn();
+
+    long iterations = 1;
+    double elapsed = 0.0;
+    while (true) {
+        auto start = clock::now();
+        for (long i = 0; i < iterations; ++i) {
+            fn();
+        }
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        if (elapsed >= min_time) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    auto ns_per_call = elapsed * 1e9 / iterations;
+    auto samples_per_sec = samples_per_call * iterations / elapsed;
+
+    printf(
+        "%s\n    { \"name\": \"%s\", \"params\": { %s }, \"iterations\": %ld, \"ns_per_call\": %.3f, \"samples_per_sec\": %.1f }",
+        first_result ? "" : ",",
+        name,
+        params,
+        iterations,
+        ns_per_call,
+        samples_per_sec
+    );
+    fflush(stdout);
+    first_result = false;
+}
+
+static void bench_fft(float* signal) {
+    char params[128];
+    const FFTPrecision precisions[] = { FFT_PRECISION_FLOAT, FFT_PRECISION_DOUBLE };
+    for (auto precision : precisions) {
+        for (int size = 64; size <= 16384; size *= 2) {
+            auto state = fft_init(size, precision);
+            auto out = new float[size];
+            auto in_area  = Area(signal, size, 1);
+            auto out_area = Area(out, size, 1);
+
+            snprintf(
+                params,
+                sizeof(params),
+                "\"window_length\": %d, \"precision\": \"%s\"",
+                size,
+                precision == FFT_PRECISION_FLOAT ? "float" : "double"
+            );
+            run_benchmark("fft_compute", params, size, [&]() {
+                fft_compute(state, in_area, out_area);
+                sink = out[1];
+            });
+
+            delete[] out;
+            fft_destroy(state);
+        }
+    }
+}
+
+static void bench_fft_batch(float* signal) {
+    char params[128];
+    constexpr int WINDOW_LENGTH = 1102;
+    const int batch_sizes[] = { 1, 4, 16 };
+
+    for (auto batch_size : batch_sizes) {
+        auto state = fft_init_batch(WINDOW_LENGTH, batch_size);
+        auto out = new float[WINDOW_LENGTH * batch_size];
+        Area in_areas[16];
+        Area out_areas[16];
+        for (int i = 0; i < batch_size; ++i) {
+            in_areas[i]  = Area(signal + i * WINDOW_LENGTH, WINDOW_LENGTH, 1);
+            out_areas[i] = Area(out + i * WINDOW_LENGTH, WINDOW_LENGTH, 1);
+        }
+
+        snprintf(params, sizeof(params), "\"window_length\": %d, \"batch_size\": %d", WINDOW_LENGTH, batch_size);
+        run_benchmark("fft_compute_batch", params, WINDOW_LENGTH * batch_size, [&]() {
+            fft_compute_batch(state, batch_size, in_areas, out_areas);
+            sink = out[1];
+        });
+
+        delete[] out;
+        fft_destroy(state);
+    }
+}
+
+static void bench_autocorrelation(float* signal) {
+    char params[160];
+    const AutocorrelationMethod methods[] = { AUTOCORRELATION_DIRECT, AUTOCORRELATION_FFT, AUTOCORRELATION_AUTO };
+    const char* method_names[] = { "direct", "fft", "auto" };
+    const int window_lengths[] = { 256, 512, 1102, 2048 };
+
+    // Lags of the vocal range, 60Hz to 1kHz
+    constexpr int MIN_LAG = SAMPLE_RATE / 1000;
+    constexpr int MAX_LAG = SAMPLE_RATE / 60;
+
+    for (auto window_length : window_lengths) {
+        for (int i = 0; i < 3; ++i) {
+            AutocorrelationState state;
+            autocorrelation_init(&state, window_length, MIN_LAG, MAX_LAG, FFT_PRECISION_FLOAT, methods[i]);
+            auto out = new float[window_length];
+            auto in_area  = Area(signal, window_length, 1);
+            auto out_area = Area(out, window_length, 1);
+
+            snprintf(
+                params,
+                sizeof(params),
+                "\"window_length\": %d, \"min_lag\": %d, \"max_lag\": %d, \"method\": \"%s\", \"chosen\": \"%s\"",
+                window_length,
+                MIN_LAG,
+                MAX_LAG,
+                method_names[i],
+                state.method == AUTOCORRELATION_DIRECT ? "direct" : "fft"
+            );
+            run_benchmark("autocorrelation_compute", params, window_length, [&]() {
+                autocorrelation_compute(&state, in_area, out_area);
+                sink = out[MIN_LAG];
+            });
+
+            delete[] out;
+            autocorrelation_destroy(&state);
+        }
+    }
+}
+
+static void bench_pitch_detect(float* signal) {
+    char params[128];
+    const PitchDetectMethod methods[] = { PITCH_DETECT_AUTOCORRELATION, PITCH_DETECT_MPM };
+    const char* method_names[] = { "acf", "mpm" };
+    const double window_times[] = { 0.0125, 0.025 };
+    const int decimations[] = { 1, 2, 4, 8 };
+
+    for (auto window_time : window_times) {
+        for (int i = 0; i < 2; ++i) {
+            for (auto decimation : decimations) {
+                PitchDetectState state;
+                pitch_detect_init_state(&state, window_time, SAMPLE_RATE, 60.0, 1000.0, FFT_PRECISION_FLOAT, methods[i], decimation);
+                auto in_area = Area(signal, state.window_length, 1);
+
+                snprintf(params, sizeof(params), "\"window_length\": %d, \"method\": \"%s\", \"decimation\": %d", state.window_length, method_names[i], decimation);
+                run_benchmark("pitch_detect_compute", params, state.window_length, [&]() {
+                    Area out;
+                    PitchDetectResult result;
+                    pitch_detect_compute(&state, in_area, &out, &result);
+                    sink = result.frequency;
+                });
+
+                pitch_detect_destroy(&state);
+            }
+        }
+    }
+}
+
+// One estimate per hop, to compare with a pitch_detect_compute per window
+static void bench_yin_pitch(float* signal) {
+    char params[128];
+    const double hop_times[] = { 0.001, 0.002 };
+
+    for (auto hop_time : hop_times) {
+        YinPitchState state;
+        yin_pitch_init(&state, 0.025, SAMPLE_RATE, 60.0, 1000.0);
+        auto hop_length = (int)(hop_time * SAMPLE_RATE);
+        auto in_area = Area(signal, hop_length, 1);
+
+        // Fill the history so every call makes a real estimate
+        for (int i = 0; i < state.history_length; i += hop_length) {
+            yin_pitch_push(&state, in_area);
+        }
+
+        snprintf(params, sizeof(params), "\"window_length\": %d, \"hop_length\": %d", state.window_length, hop_length);
+        run_benchmark("yin_pitch_push_compute", params, hop_length, [&]() {
+            Area out;
+            PitchDetectResult result;
+            yin_pitch_push(&state, in_area);
+            yin_pitch_compute(&state, &out, &result);
+            sink = result.frequency;
+        });
+
+        yin_pitch_destroy(&state);
+    }
+}
+
+static void bench_poly_pitch(float* signal) {
+    char params[128];
+    const double window_times[] = { 0.05, 0.1 };
+
+    for (auto window_time : window_times) {
+        PolyPitchState state;
+        poly_pitch_init(&state, window_time, SAMPLE_RATE);
+        auto in_area = Area(signal, state.window_length, 1);
+
+        snprintf(params, sizeof(params), "\"window_length\": %d, \"num_candidates\": %d", state.window_length, state.num_candidates);
+        run_benchmark("poly_pitch_compute", params, state.window_length, [&]() {
+            Area out;
+            PolyPitchResult result;
+            poly_pitch_compute(&state, in_area, &out, &result);
+            sink = result.num_pitches;
+        });
+
+        poly_pitch_destroy(&state);
+    }
+}
+
+// One window every 5 ms, decoded with the default lookahead
+static void bench_pitch_track(float* signal, int num_samples) {
+    char params[128];
+    PitchTrackState state;
+    pitch_track_init(&state, 0.025, SAMPLE_RATE);
+    auto window_length = state.yin_state.window_length;
+    auto hop_length = (int)(0.005 * SAMPLE_RATE);
+
+    long start_count = 0;
+    snprintf(params, sizeof(params), "\"window_length\": %d, \"hop_length\": %d, \"num_states\": %d", window_length, hop_length, state.num_states);
+    run_benchmark("pitch_track_compute", params, hop_length, [&]() {
+        PitchTrackResult result;
+        auto offset = (int)(start_count % (num_samples - window_length));
+        pitch_track_compute(&state, Area(signal + offset, window_length, 1), offset, &result);
+        start_count += hop_length;
+        sink = result.pitch.frequency;
+    });
+
+    pitch_track_destroy(&state);
+}
+
+static void bench_levels(float* signal) {
+    char params[128];
+    for (int size = 256; size <= 4096; size *= 4) {
+        LevelsState state;
+        levels_init(&state, SAMPLE_RATE, DECAY_TIME, size);
+        auto in_area = Area(signal, size, 1);
+
+        snprintf(params, sizeof(params), "\"window_length\": %d", size);
+        run_benchmark("levels_compute", params, size, [&]() {
+            Area out;
+            levels_compute(&state, in_area, &out);
+            sink = *out;
+        });
+
+        levels_destroy(&state);
+    }
+}
+
+static void bench_envelope_detect(float* signal, int num_samples) {
+    char params[128];
+
+    // Run the detector over the level curve of the signal
+    LevelsState lvl_state;
+    levels_init(&lvl_state, SAMPLE_RATE, DECAY_TIME, num_samples);
+    Area lvl_area;
+    levels_compute(&lvl_state, Area(signal, num_samples, 1), &lvl_area);
+
+    for (int size = 256; size <= 4096; size *= 4) {
+        EnvelopeDetectState state;
+        envelope_detect_init(&state);
+        auto in_area = Area(lvl_area.ptr, size, 1);
+        long start_time = 0;
+
+        snprintf(params, sizeof(params), "\"window_length\": %d", size);
+        run_benchmark("envelope_detect_compute", params, size, [&]() {
+            envelope_detect_compute(&state, SAMPLE_RATE, start_time, in_area, 0.0f);
+            start_time += size;
+            sink = (float)state.time_attack;
+        });
+    }
+
+    levels_destroy(&lvl_state);
+}
+
+static void bench_render_peaks(float* signal, int num_samples) {
+    char params[128];
+    const unsigned char color[4] = { 0x00, 0x99, 0x00, 0xff };
+    const int widths[] = { 200, 700, 1400 };
+    const int sample_counts[] = { 1024, SAMPLE_RATE, SAMPLE_RATE * 10 };
+    constexpr int HEIGHT = 200;
+
+    for (auto width : widths) {
+        auto data = new unsigned char[4 * width * HEIGHT];
+        for (auto count : sample_counts) {
+            if (count > num_samples) {
+                continue;
+            }
+            auto area = Area(signal, count, 1);
+
+            snprintf(params, sizeof(params), "\"width\": %d, \"height\": %d, \"num_samples\": %d", width, HEIGHT, count);
+            run_benchmark("render_peaks", params, count, [&]() {
+                render_peaks(data, width, HEIGHT, area, color);
+                sink = data[0];
+            });
+        }
+        delete[] data;
+    }
+}
+
+static void bench_copy_over(float* signal) {
+    char params[128];
+    constexpr int SIZE = 4096;
+    auto out = new float[SIZE * 2];
+
+    for (int step = 1; step <= 2; ++step) {
+        auto in_area  = Area(signal, SIZE, step);
+        auto out_area = Area(out, SIZE, step);
+
+        snprintf(params, sizeof(params), "\"num_samples\": %d, \"step\": %d", SIZE, step);
+        run_benchmark("Area::copy_over", params, SIZE, [&]() {
+            sink = (float)Area::copy_over(in_area, out_area);
+        });
+    }
+
+    delete[] out;
+}
+
+static void bench_ring_buffer(float* signal) {
+    char params[128];
+    const int block_sizes[] = { 32, 256, 441, 1024 };
+
+    for (auto block_size : block_sizes) {
+        RingBufferState rb;
+        RingBufferReaderState rbr;
+        ring_buffer_init(&rb, SAMPLE_RATE);
+        ring_buffer_reader_init(&rb, &rbr);
+        auto in_area = Area(signal, block_size, 1);
+
+        snprintf(params, sizeof(params), "\"block_size\": %d", block_size);
+        run_benchmark("ring_buffer_write_read", params, block_size, [&]() {
+            ring_buffer_write(&rb, block_size, 1, &in_area);
+
+            auto in = ring_buffer_read(&rb, &rbr, block_size);
+            float sum = 0.0f;
+            while (in < in.end) {
+                sum += *in++;
+            }
+            sink = sum;
+        });
+
+        ring_buffer_destroy(&rb);
+    }
+
+    // Per-channel reads of a stereo buffer in both layouts
+    constexpr int NUM_AREAS = 2;
+    constexpr int BLOCK_SIZE = 1024;
+    const RingBufferLayout layouts[] = { RING_BUFFER_INTERLEAVED, RING_BUFFER_PLANAR };
+    for (auto layout : layouts) {
+        RingBufferState rb;
+        RingBufferReaderState rbr;
+        ring_buffer_init(&rb, SAMPLE_RATE, NUM_AREAS, RING_BUFFER_HEAP, layout);
+        ring_buffer_reader_init(&rb, &rbr);
+        Area in_areas[NUM_AREAS];
+        for (int i = 0; i < NUM_AREAS; ++i) {
+            in_areas[i] = Area(signal + i * BLOCK_SIZE, BLOCK_SIZE, 1);
+        }
+
+        snprintf(
+            params,
+            sizeof(params),
+            "\"block_size\": %d, \"num_areas\": %d, \"layout\": \"%s\"",
+            BLOCK_SIZE,
+            NUM_AREAS,
+            layout == RING_BUFFER_PLANAR ? "planar" : "interleaved"
+        );
+        run_benchmark("ring_buffer_write_read", params, BLOCK_SIZE * NUM_AREAS, [&]() {
+            ring_buffer_write(&rb, BLOCK_SIZE, NUM_AREAS, in_areas);
+
+            Area out_areas[NUM_AREAS];
+            ring_buffer_read(&rb, &rbr, BLOCK_SIZE, NUM_AREAS, out_areas);
+            float sum = 0.0f;
+            for (auto in : out_areas) {
+                while (in < in.end) {
+                    sum += *in++;
+                }
+            }
+            sink = sum;
+        });
+
+        ring_buffer_destroy(&rb);
+    }
+
+    // Converting reads from each storage format
+    const SampleFormat formats[] = { SAMPLE_FORMAT_FLOAT32, SAMPLE_FORMAT_INT16, SAMPLE_FORMAT_INT24 };
+    const char* format_names[] = { "float32", "int16", "int24" };
+    auto out = new float[BLOCK_SIZE];
+    for (int i = 0; i < 3; ++i) {
+        RingBufferState rb;
+        RingBufferReaderState rbr;
+        ring_buffer_init(&rb, SAMPLE_RATE, 1, RING_BUFFER_HEAP, RING_BUFFER_PLANAR, formats[i]);
+        ring_buffer_reader_init(&rb, &rbr);
+        auto in_area = Area(signal, BLOCK_SIZE, 1);
+        auto out_area = Area(out, BLOCK_SIZE, 1);
+
+        snprintf(params, sizeof(params), "\"block_size\": %d, \"format\": \"%s\"", BLOCK_SIZE, format_names[i]);
+        run_benchmark("ring_buffer_write_read_convert", params, BLOCK_SIZE, [&]() {
+            ring_buffer_write(&rb, BLOCK_SIZE, 1, &in_area);
+            ring_buffer_read_convert(&rb, &rbr, BLOCK_SIZE, 1, &out_area);
+            sink = out[BLOCK_SIZE - 1];
+        });
+
+        ring_buffer_destroy(&rb);
+    }
+    delete[] out;
+}
+
+int main(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+        switch (opt) {
+            case 't':
+                min_time = atof(optarg);
+                break;
+            case 'f':
+                name_filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t min_time_seconds] [-f name_filter]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    constexpr int NUM_SAMPLES = SAMPLE_RATE * 10;
+    auto signal = new float[NUM_SAMPLES * 2];
+    fill_signal(signal, NUM_SAMPLES * 2);
+
+    printf("{\n  \"sample_rate\": %d,\n  \"min_time\": %f,\n  \"benchmarks\": [", SAMPLE_RATE, min_time);
+
+    bench_fft(signal);
+    bench_fft_batch(signal);
+    bench_autocorrelation(signal);
+    bench_pitch_detect(signal);
+    bench_yin_pitch(signal);
+    bench_poly_pitch(signal);
+    bench_pitch_track(signal, NUM_SAMPLES);
+    bench_levels(signal);
+    bench_envelope_detect(signal, NUM_SAMPLES);
+    bench_render_peaks(signal, NUM_SAMPLES);
+    bench_copy_over(signal);
+    bench_ring_buffer(signal);
+
+    printf("\n  ]\n}\n");
+
+    delete[] signal;
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "mirrored_memory.hpp"
+#include <atomic>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+size_t mirrored_page_size() {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+int mirrored_create_fd(size_t size) {
+    int fd;
+
+#if defined(__linux__)
+    fd = memfd_create("bmjap", MFD_CLOEXEC);
+#else
+    // No memfd, so make a uniquely named shm object and unlink it right away
+    static std::atomic_int counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/bmjap.%ld.%d", (long)getpid(), counter++);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) {
+        shm_unlink(name);
+    }
+#endif
+
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool map_twice(char* ptr, int fd, size_t offset, size_t size, int prot) {
+    auto first  = mmap(ptr,        size, prot, MAP_SHARED | MAP_FIXED, fd, (off_t)offset);
+    auto second = mmap(ptr + size, size, prot, MAP_SHARED | MAP_FIXED, fd, (off_t)offset);
+    return first != MAP_FAILED && second != MAP_FAILED;
+}
+
+void* mirrored_map(int fd, size_t offset, size_t size, int prot) {
+
+    // Reserve the address range for both copies, then map over it
+    auto base = (char*)mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (!map_twice(base, fd, offset, size, prot)) {
+        munmap(base, 2 * size);
+        return nullptr;
+    }
+
+    return base;
+}
+
+void* mirrored_map_many(int fd, size_t offset, size_t size, int count, int prot) {
+    auto base = (char*)mmap(NULL, 2 * size * count, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (!map_twice(base + 2 * size * i, fd, offset + size * i, size, prot)) {
+            munmap(base, 2 * size * count);
+            return nullptr;
+        }
+    }
+
+    return base;
+}
+
+void mirrored_unmap(void* ptr, size_t size) {
+    munmap(ptr, 2 * size);
+}
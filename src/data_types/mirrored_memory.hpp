@@ -0,0 +1,26 @@
+#ifndef mirrored_memory_hpp
+#define mirrored_memory_hpp
+
+#include <stddef.h>
+
+// Virtual memory tricks for ring buffers: the same pages are mapped twice,
+// back to back, so that any access running past the end of the first copy
+// continues at the start of the region without a wrap-around split.
+
+size_t mirrored_page_size();
+
+// Creates an anonymous shared memory object of size bytes (memfd on Linux,
+// an unlinked POSIX shm object elsewhere). Returns -1 on failure.
+int mirrored_create_fd(size_t size);
+
+// Maps size bytes at offset of fd twice in a row. size and offset must be
+// multiples of the page size. Returns nullptr on failure.
+void* mirrored_map(int fd, size_t offset, size_t size, int prot);
+
+// Maps count consecutive regions of size bytes starting at offset of fd,
+// each mirrored, one after the other: [0 0 1 1 2 2 ...]. Unmap with
+// mirrored_unmap(ptr, count * size).
+void* mirrored_map_many(int fd, size_t offset, size_t size, int count, int prot);
+void mirrored_unmap(void* ptr, size_t size);
+
+#endif
@@ -1,94 +1,539 @@
 #include "ring_buffer.hpp"
+#include "mirrored_memory.hpp"
 #include <cmath>
 #include <assert.h>
 #include <time.h>
 #include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-void ring_buffer_init(RingBufferState* rb, int buffer_size, int num_areas) {
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <stdint.h>
+
+// Darwin's futex equivalent (libsystem_kernel, macOS 10.12+). The SHARED
+// operation works on memory mapped by several processes.
+extern "C" int __ulock_wait(uint32_t operation, void* address, uint64_t value, uint32_t timeout_us);
+extern "C" int __ulock_wake(uint32_t operation, void* address, uint64_t wake_value);
+constexpr uint32_t UL_COMPARE_AND_WAIT_SHARED = 3;
+constexpr uint32_t ULF_WAKE_ALL = 0x00000100;
+#endif
+
+static size_t buffer_bytes(RingBufferState* rb) {
+    return (size_t)rb->sample_size * rb->buffer_size * rb->num_areas;
+}
+
+static char* sample_ptr(RingBufferState* rb, int area, int pos) {
+    return rb->buffer + (size_t)(area * rb->area_offset + pos * rb->step) * rb->sample_size;
+}
+
+// Only float buffers can be handed out as Areas
+static float* area_ptr(RingBufferState* rb, int area, int pos) {
+    assert(rb->format == SAMPLE_FORMAT_FLOAT32);
+    return (float*)sample_ptr(rb, area, pos);
+}
+
+static size_t header_bytes() {
+    auto page_size = mirrored_page_size();
+    return (sizeof(RingBufferHeader) + page_size - 1) / page_size * page_size;
+}
+
+// Maps the samples at offset of fd, mirrored. Planar buffers mirror every
+// area's region on its own.
+static bool map_mirrored(RingBufferState* rb, int fd, size_t offset, int prot) {
+    auto size = buffer_bytes(rb);
+    void* ptr;
+    if (rb->layout == RING_BUFFER_PLANAR) {
+        ptr = mirrored_map_many(fd, offset, size / rb->num_areas, rb->num_areas, prot);
+    } else {
+        ptr = mirrored_map(fd, offset, size, prot);
+    }
+    if (!ptr) {
+        return false;
+    }
+    rb->buffer = (char*)ptr;
+    return true;
+}
+
+static bool init_mirrored(RingBufferState* rb) {
+    auto fd = mirrored_create_fd(buffer_bytes(rb));
+    if (fd == -1) {
+        return false;
+    }
+    auto result = map_mirrored(rb, fd, 0, PROT_READ | PROT_WRITE);
+    close(fd); // the mappings keep the memory alive
+    return result;
+}
+
+static int round_buffer_size(int buffer_size, RingBufferMode mode, SampleFormat format) {
     buffer_size = (int)exp2(ceil(log2(buffer_size)));
-    rb->buffer = new float[buffer_size * num_areas];
-    rb->step = num_areas;
+
+    if (mode != RING_BUFFER_HEAP) {
+        // Each copy has to be a whole number of pages (24-bit samples need
+        // a page worth of samples for that)
+        auto sample_size = sample_format_size(format);
+        auto min_size = (int)(mirrored_page_size() / (sample_size & -sample_size));
+        if (buffer_size < min_size) {
+            buffer_size = min_size;
+        }
+    }
+    return buffer_size;
+}
+
+static void init_fields(RingBufferState* rb, int buffer_size, int num_areas, RingBufferMode mode, RingBufferLayout layout, SampleFormat format) {
+    assert(num_areas >= 1 && num_areas <= RING_BUFFER_MAX_AREAS);
+
+    rb->num_areas = num_areas;
     rb->buffer_size = buffer_size;
-    rb->write_point = 0;
+    rb->format = format;
+    rb->sample_size = sample_format_size(format);
+    rb->mode = mode;
+    rb->layout = layout;
+    rb->read_only = false;
+    rb->shared_name[0] = '\0';
+    for (auto& reader_point : rb->reader_points) {
+        reader_point = RING_BUFFER_NO_READER;
+    }
+    rb->backpressure_threshold = 0;
 }
 
-void ring_buffer_start_write(RingBufferState* rb, int num_samples, int num_areas, Area* areas) {
-    assert(num_samples <= rb->buffer_size);
-    assert(num_areas <= rb->step);
+static void init_header(RingBufferState* rb, size_t data_offset) {
+    auto header = rb->header;
+    header->magic = 0;
+    header->version = RING_BUFFER_VERSION;
+    header->buffer_size = rb->buffer_size;
+    header->num_areas = rb->num_areas;
+    header->layout = rb->layout;
+    header->format = rb->format;
+    header->sample_size = rb->sample_size;
+    header->data_offset = (int64_t)data_offset;
+    header->write_point = 0;
+    header->write_pending = 0;
+    header->wake_point = LONG_MAX;
+    header->wake_seq = 0;
+    header->num_waiters = 0;
 
-    auto write_point_mod = rb->write_point.load() % rb->buffer_size;
-    assert((rb->buffer_size - write_point_mod) % num_samples == 0);
-    if (write_point_mod == 0) {
-        for (int i = 0; i < num_areas; ++i) {
-            areas[i] = Area(&rb->buffer[i], num_samples, rb->step);
-        }
+    // Clients of a shared buffer check the magic, so write it last
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = RING_BUFFER_MAGIC;
+}
+
+// Call once the mode is final
+static void init_layout(RingBufferState* rb) {
+    if (rb->layout == RING_BUFFER_PLANAR) {
+        rb->step = 1;
+        rb->area_offset = rb->mode == RING_BUFFER_HEAP ? rb->buffer_size : 2 * rb->buffer_size;
     } else {
-        for (int i = 0; i < num_areas; ++i) {
-            areas[i] = Area(&rb->buffer[i] + write_point_mod * rb->step, num_samples, rb->step);
-        }
+        rb->step = rb->num_areas;
+        rb->area_offset = 1;
     }
 }
 
-Area ring_buffer_start_write(RingBufferState* rb, int num_samples) {
-    Area area;
-    ring_buffer_start_write(rb, num_samples, 1, &area);
-    return area;
+void ring_buffer_init(RingBufferState* rb, int buffer_size, int num_areas, RingBufferMode mode, RingBufferLayout layout, SampleFormat format) {
+    assert(mode != RING_BUFFER_SHARED); // see ring_buffer_init_shared
+
+    init_fields(rb, round_buffer_size(buffer_size, mode, format), num_areas, mode, layout, format);
+
+    if (mode == RING_BUFFER_MIRRORED && !init_mirrored(rb)) {
+        fprintf(stderr, "Failed to map mirrored ring buffer, falling back to heap\n");
+        rb->mode = RING_BUFFER_HEAP;
+    }
+    if (rb->mode == RING_BUFFER_HEAP) {
+        rb->buffer = new char[buffer_bytes(rb)];
+    }
+
+    rb->header = new RingBufferHeader;
+    init_header(rb, 0);
+    init_layout(rb);
 }
 
-void ring_buffer_end_write(RingBufferState* rb, int num_samples) {
-    rb->write_point += num_samples;
+bool ring_buffer_init_shared(RingBufferState* rb, const char* name, int buffer_size, int num_areas, RingBufferLayout layout, SampleFormat format) {
+    init_fields(rb, round_buffer_size(buffer_size, RING_BUFFER_SHARED, format), num_areas, RING_BUFFER_SHARED, layout, format);
+    if (strlen(name) >= sizeof(rb->shared_name)) {
+        fprintf(stderr, "Shared ring buffer name too long: %s\n", name);
+        return false;
+    }
+
+    auto fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to create shared ring buffer %s\n", name);
+        return false;
+    }
+
+    auto data_offset = header_bytes();
+    auto ok = ftruncate(fd, (off_t)(data_offset + buffer_bytes(rb))) == 0;
+    if (ok) {
+        auto ptr = mmap(NULL, data_offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ok = ptr != MAP_FAILED;
+        rb->header = (RingBufferHeader*)ptr;
+    }
+    if (ok && !map_mirrored(rb, fd, data_offset, PROT_READ | PROT_WRITE)) {
+        munmap(rb->header, data_offset);
+        ok = false;
+    }
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "Failed to map shared ring buffer %s\n", name);
+        shm_unlink(name);
+        return false;
+    }
+
+    init_header(rb, data_offset);
+    strcpy(rb->shared_name, name);
+    init_layout(rb);
+    return true;
 }
 
-void ring_buffer_reader_init(RingBufferState* rb, RingBufferReaderState* rbr) {
-    *rbr = rb->write_point.load();
+bool ring_buffer_attach(RingBufferState* rb, const char* name) {
+    auto fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        fprintf(stderr, "No shared ring buffer %s\n", name);
+        return false;
+    }
+
+    // The header is writable, clients take part in the wakeup protocol
+    auto header = (RingBufferHeader*)mmap(NULL, header_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        fprintf(stderr, "Failed to map shared ring buffer %s\n", name);
+        return false;
+    }
+
+    struct stat st;
+    auto valid = (
+        fstat(fd, &st) == 0 &&
+        header->magic == RING_BUFFER_MAGIC &&
+        header->version == RING_BUFFER_VERSION &&
+        header->format >= SAMPLE_FORMAT_FLOAT32 && header->format <= SAMPLE_FORMAT_INT24 &&
+        header->sample_size == sample_format_size((SampleFormat)header->format) &&
+        header->data_offset == (int64_t)header_bytes() &&
+        header->num_areas >= 1 && header->num_areas <= RING_BUFFER_MAX_AREAS &&
+        st.st_size >= header->data_offset + (int64_t)header->sample_size * header->buffer_size * header->num_areas
+    );
+    if (!valid) {
+        munmap(header, header_bytes());
+        close(fd);
+        fprintf(stderr, "Shared ring buffer %s has an unknown format\n", name);
+        return false;
+    }
+
+    init_fields(rb, header->buffer_size, header->num_areas, RING_BUFFER_SHARED, (RingBufferLayout)header->layout, (SampleFormat)header->format);
+    rb->header = header;
+    rb->read_only = true;
+    auto ok = map_mirrored(rb, fd, header_bytes(), PROT_READ);
+    close(fd);
+    if (!ok) {
+        munmap(header, header_bytes());
+        fprintf(stderr, "Failed to map shared ring buffer %s\n", name);
+        return false;
+    }
+
+    init_layout(rb);
+    return true;
 }
 
-bool ring_buffer_can_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples) {
+// A heap buffer splits blocks that cross the end, a mirrored one doesn't.
+// Returns the size of the first part.
+static int split_at_end(RingBufferState* rb, int pos, int num_samples) {
+    if (rb->mode == RING_BUFFER_HEAP && pos + num_samples > rb->buffer_size) {
+        return rb->buffer_size - pos;
+    }
+    return num_samples;
+}
+
+static int begin_write(RingBufferState* rb, int num_samples, int num_areas) {
     assert(num_samples <= rb->buffer_size);
+    assert(num_areas <= rb->num_areas);
+    assert(!rb->read_only);
 
-    auto write_point = rb->write_point.load();
-    return (*rbr + num_samples <= write_point);
+    rb->header->write_pending = num_samples;
+    return (int)(rb->header->write_point.load() % rb->buffer_size);
 }
 
-void ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas) {
-    assert(num_samples <= rb->buffer_size);
-    assert(num_areas <= rb->step);
+int ring_buffer_start_write(RingBufferState* rb, int num_samples, int num_areas, Area* areas, Area* areas_wrapped) {
+    auto write_point_mod = begin_write(rb, num_samples, num_areas);
+    auto num_samples_1 = split_at_end(rb, write_point_mod, num_samples);
+    auto num_samples_2 = num_samples - num_samples_1;
 
-    constexpr double SAMPLE_RATE_GUESS = 44100.0;
+    for (int i = 0; i < num_areas; ++i) {
+        areas[i] = Area(area_ptr(rb, i, write_point_mod), num_samples_1, rb->step);
+        areas_wrapped[i] = Area(area_ptr(rb, i, 0), num_samples_2, rb->step);
+    }
 
-    // Sleep until enough samples are available
-    long write_point;
-    while (true) {
-        write_point = rb->write_point.load();
-        auto available = write_point - *rbr;
-        if (available >= num_samples) {
-            break;
+    return num_samples_2 > 0 ? 2 : 1;
+}
+
+int ring_buffer_start_write(RingBufferState* rb, int num_samples, Area* area, Area* area_wrapped) {
+    return ring_buffer_start_write(rb, num_samples, 1, area, area_wrapped);
+}
+
+void ring_buffer_write(RingBufferState* rb, int num_samples, int num_areas, Area* in) {
+    auto write_point_mod = begin_write(rb, num_samples, num_areas);
+    auto num_samples_1 = split_at_end(rb, write_point_mod, num_samples);
+
+    for (int i = 0; i < num_areas; ++i) {
+        auto in_1 = Area(in[i].ptr, num_samples_1, in[i].step);
+        auto in_2 = Area(in[i].ptr + num_samples_1 * in[i].step, num_samples - num_samples_1, in[i].step);
+        sample_encode(rb->format, in_1, sample_ptr(rb, i, write_point_mod), rb->step);
+        sample_encode(rb->format, in_2, sample_ptr(rb, i, 0), rb->step);
+    }
+    ring_buffer_end_write(rb, num_samples);
+}
+
+// Sleeps while *address == expected, for at most timeout seconds (or for
+// ever if timeout < 0). May return early.
+static void wait_on_address(std::atomic_int* address, int expected, double timeout) {
+#if defined(__linux__)
+    timespec ts;
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1000000000.0);
+    syscall(SYS_futex, (int*)address, FUTEX_WAIT, expected, timeout < 0.0 ? NULL : &ts, NULL, 0);
+#elif defined(__APPLE__)
+    // A timeout of 0 waits for ever, so round short ones up to 1 us
+    uint32_t timeout_us = 0;
+    if (timeout >= 0.0) {
+        timeout_us = timeout * 1000000.0 < UINT32_MAX ? (uint32_t)(timeout * 1000000.0) : UINT32_MAX;
+        if (timeout_us == 0) {
+            timeout_us = 1;
+        }
+    }
+    __ulock_wait(UL_COMPARE_AND_WAIT_SHARED, (void*)address, (uint64_t)(uint32_t)expected, timeout_us);
+#else
+    // Neither a futex nor a ulock here, so poll in short naps
+    constexpr double POLL_INTERVAL = 0.00025;
+    if (timeout < 0.0 || timeout > POLL_INTERVAL) {
+        timeout = POLL_INTERVAL;
+    }
+    timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long)(timeout * 1000000000.0);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static void wake_address(std::atomic_int* address) {
+#if defined(__linux__)
+    syscall(SYS_futex, (int*)address, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#elif defined(__APPLE__)
+    __ulock_wake(UL_COMPARE_AND_WAIT_SHARED | ULF_WAKE_ALL, (void*)address, 0);
+#endif
+}
+
+static double now_in_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void ring_buffer_end_write(RingBufferState* rb, int num_samples) {
+    auto write_point = (rb->header->write_point += num_samples);
+
+    // Fast path: nobody is waiting for what we just wrote
+    if (rb->header->num_waiters.load() == 0) {
+        return;
+    }
+    auto wake_point = rb->header->wake_point.load();
+    if (write_point < wake_point) {
+        return;
+    }
+
+    // Wake every waiter, each re-registers what it still needs
+    rb->header->wake_point.compare_exchange_strong(wake_point, LONG_MAX);
+    rb->header->wake_seq++;
+    wake_address(&rb->header->wake_seq);
+}
+
+void ring_buffer_reader_init(RingBufferState* rb, RingBufferReaderState* rbr, RingBufferOverrunPolicy overrun_policy) {
+    ring_buffer_reader_init_at(rbr, rb->header->write_point.load(), overrun_policy);
+}
+
+void ring_buffer_reader_init_at(RingBufferReaderState* rbr, long read_point, RingBufferOverrunPolicy overrun_policy) {
+    rbr->read_point = read_point;
+    rbr->overrun_policy = overrun_policy;
+    rbr->lost_samples = 0;
+    rbr->peak_lag = 0;
+    rbr->slot = -1;
+}
+
+long ring_buffer_reader_lost_samples(RingBufferReaderState* rbr) {
+    return rbr->lost_samples;
+}
+
+bool ring_buffer_register_reader(RingBufferState* rb, RingBufferReaderState* rbr) {
+    assert(rbr->slot == -1);
+    assert(rbr->read_point != RING_BUFFER_NO_READER);
+    for (int i = 0; i < RING_BUFFER_MAX_READERS; ++i) {
+        long empty = RING_BUFFER_NO_READER;
+        if (rb->reader_points[i].compare_exchange_strong(empty, rbr->read_point)) {
+            rbr->slot = i;
+            return true;
         }
+    }
+    fprintf(stderr, "Ring buffer has no room for another reader\n");
+    return false;
+}
 
-        auto remaining_in_seconds = (num_samples - available) / SAMPLE_RATE_GUESS;
-        timespec ts;
-        ts.tv_sec = (int)remaining_in_seconds;
-        ts.tv_nsec = (long)((remaining_in_seconds - ts.tv_sec) * 1000000000.0);
-        nanosleep(&ts, NULL);
+void ring_buffer_unregister_reader(RingBufferState* rb, RingBufferReaderState* rbr) {
+    if (rbr->slot != -1) {
+        rb->reader_points[rbr->slot] = RING_BUFFER_NO_READER;
+        rbr->slot = -1;
     }
+}
+
+long ring_buffer_reader_fill(RingBufferState* rb, RingBufferReaderState* rbr) {
+    return rb->header->write_point.load() - rbr->read_point;
+}
+
+long ring_buffer_reader_peak_lag(RingBufferReaderState* rbr) {
+    return rbr->peak_lag.load();
+}
 
-    int read_point_mod = *rbr % rb->buffer_size;
-    if (read_point_mod + num_samples <= rb->buffer_size) {
-        for (int i = 0; i < num_areas; ++i) {
-            areas[i] = Area(&rb->buffer[i] + read_point_mod * rb->step, num_samples, rb->step);
+long ring_buffer_slowest_lag(RingBufferState* rb) {
+    auto write_point = rb->header->write_point.load();
+    long lag = 0;
+    for (auto& reader_point : rb->reader_points) {
+        auto read_point = reader_point.load();
+        if (read_point != RING_BUFFER_NO_READER && write_point - read_point > lag) {
+            lag = write_point - read_point;
         }
-    } else if (read_point_mod == rb->buffer_size) {
-        for (int i = 0; i < num_areas; ++i) {
-            areas[i] = Area(&rb->buffer[i], num_samples, rb->step);
+    }
+    return lag;
+}
+
+void ring_buffer_set_backpressure(RingBufferState* rb, long threshold_samples) {
+    rb->backpressure_threshold = threshold_samples;
+}
+
+bool ring_buffer_backpressure(RingBufferState* rb) {
+    auto threshold = rb->backpressure_threshold.load();
+    return threshold > 0 && ring_buffer_slowest_lag(rb) >= threshold;
+}
+
+bool ring_buffer_can_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples) {
+    assert(num_samples <= rb->buffer_size);
+
+    auto write_point = rb->header->write_point.load();
+    return (rbr->read_point + num_samples <= write_point);
+}
+
+// Waits until num_samples past the read point have been written. A negative
+// timeout waits for ever, zero doesn't wait at all.
+static bool wait_for_samples(RingBufferState* rb, long read_point, int num_samples, double timeout) {
+    auto target = read_point + num_samples;
+    if (rb->header->write_point.load() >= target) {
+        return true;
+    }
+    if (timeout == 0.0) {
+        return false;
+    }
+
+    auto deadline = now_in_seconds() + timeout;
+    while (true) {
+
+        rb->header->num_waiters++;
+        auto seq = rb->header->wake_seq.load();
+
+        // Register the write point we need (the lowest of all waiters wins).
+        // If a wakeup clears it after this, wake_seq has moved past seq.
+        auto wake_point = rb->header->wake_point.load();
+        while (target < wake_point && !rb->header->wake_point.compare_exchange_weak(wake_point, target)) {}
+
+        // Check again now the writer can see us, so we can't miss a wakeup
+        if (rb->header->write_point.load() >= target) {
+            rb->header->num_waiters--;
+            return true;
         }
-    } else {
-        int available = rb->buffer_size - read_point_mod;
-        for (int i = 0; i < num_areas; ++i) {
-            areas[i] = Area(&rb->buffer[i], available, rb->step);
+
+        double remaining = -1.0;
+        if (timeout > 0.0) {
+            remaining = deadline - now_in_seconds();
+            if (remaining <= 0.0) {
+                rb->header->num_waiters--;
+                return false;
+            }
         }
+
+        wait_on_address(&rb->header->wake_seq, seq, remaining);
+        rb->header->num_waiters--;
+    }
+}
+
+// Moves the reader, publishing the new read point if it's registered
+static void set_read_point(RingBufferState* rb, RingBufferReaderState* rbr, long read_point) {
+    rbr->read_point = read_point;
+    if (rbr->slot != -1) {
+        rb->reader_points[rbr->slot] = read_point;
+    }
+}
+
+static void update_peak_lag(RingBufferState* rb, RingBufferReaderState* rbr) {
+    auto lag = rb->header->write_point.load() - rbr->read_point;
+    if (lag > rbr->peak_lag.load()) {
+        rbr->peak_lag = lag;
+    }
+}
+
+static void read_areas(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas) {
+    update_peak_lag(rb, rbr);
+
+    // Reads that cross the end of the buffer are cut short, the caller picks
+    // up the rest with the next read (a mirrored buffer never needs to)
+    int read_point_mod = rbr->read_point % rb->buffer_size;
+    num_samples = split_at_end(rb, read_point_mod, num_samples);
+    for (int i = 0; i < num_areas; ++i) {
+        areas[i] = Area(area_ptr(rb, i, read_point_mod), num_samples, rb->step);
+    }
+
+    set_read_point(rb, rbr, rbr->read_point + num_samples);
+}
+
+// Returns false if the reader was lapped and its policy is to fail
+static bool check_overrun(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples) {
+
+    // The writer may be filling the block just past the write point, which
+    // overlaps the oldest samples in the buffer
+    auto write_point = rb->header->write_point.load();
+    auto oldest = write_point - rb->buffer_size + rb->header->write_pending.load();
+    if (rbr->read_point >= oldest) {
+        return true;
+    }
+
+    long read_point;
+    switch (rbr->overrun_policy) {
+        case RING_BUFFER_SKIP_TO_NEWEST:
+            read_point = write_point - num_samples;
+            if (read_point < oldest) {
+                read_point = oldest;
+            }
+            break;
+        case RING_BUFFER_SKIP_TO_OLDEST:
+            read_point = oldest;
+            break;
+        case RING_BUFFER_FAIL:
+        default:
+            read_point = write_point;
+            break;
+    }
+
+    rbr->lost_samples += read_point - rbr->read_point;
+    set_read_point(rb, rbr, read_point);
+    return rbr->overrun_policy != RING_BUFFER_FAIL;
+}
+
+static void fail_areas(RingBufferState* rb, int num_areas, Area* areas) {
+    for (int i = 0; i < num_areas; ++i) {
+        areas[i] = Area((float*)rb->buffer, 0, 1);
     }
+}
 
-    *rbr += num_samples;
+bool ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas) {
+    return ring_buffer_timed_read(rb, rbr, num_samples, -1.0, num_areas, areas);
 }
 
 Area ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples) {
@@ -97,6 +542,98 @@ Area ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_s
     return area;
 }
 
+bool ring_buffer_try_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas) {
+    return ring_buffer_timed_read(rb, rbr, num_samples, 0.0, num_areas, areas);
+}
+
+bool ring_buffer_try_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, Area* area) {
+    return ring_buffer_timed_read(rb, rbr, num_samples, 0.0, 1, area);
+}
+
+bool ring_buffer_timed_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, double timeout, int num_areas, Area* areas) {
+    assert(num_samples <= rb->buffer_size);
+    assert(num_areas <= rb->num_areas);
+
+    if (!wait_for_samples(rb, rbr->read_point, num_samples, timeout)) {
+        fail_areas(rb, num_areas, areas);
+        return false;
+    }
+    if (!check_overrun(rb, rbr, num_samples)) {
+        fail_areas(rb, num_areas, areas);
+        return false;
+    }
+    read_areas(rb, rbr, num_samples, num_areas, areas);
+    return true;
+}
+
+bool ring_buffer_timed_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, double timeout, Area* area) {
+    return ring_buffer_timed_read(rb, rbr, num_samples, timeout, 1, area);
+}
+
+bool ring_buffer_span_intact(RingBufferState* rb, long start, int num_samples) {
+
+    // Same bounds as check_overrun, a block being written counts as lost
+    auto write_point = rb->header->write_point.load();
+    auto oldest = write_point - rb->buffer_size + rb->header->write_pending.load();
+    return start >= oldest && start + num_samples <= write_point;
+}
+
+bool ring_buffer_peek(RingBufferState* rb, long start, int num_samples, int num_areas, Area* areas) {
+    assert(num_areas <= rb->num_areas);
+
+    int start_mod = start % rb->buffer_size;
+    if (split_at_end(rb, start_mod, num_samples) != num_samples) {
+        return false;
+    }
+    if (!ring_buffer_span_intact(rb, start, num_samples)) {
+        return false;
+    }
+    for (int i = 0; i < num_areas; ++i) {
+        areas[i] = Area(area_ptr(rb, i, start_mod), num_samples, rb->step);
+    }
+    return true;
+}
+
+bool ring_buffer_read_convert(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* out) {
+    return ring_buffer_timed_read_convert(rb, rbr, num_samples, -1.0, num_areas, out);
+}
+
+bool ring_buffer_timed_read_convert(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, double timeout, int num_areas, Area* out) {
+    assert(num_samples <= rb->buffer_size);
+    assert(num_areas <= rb->num_areas);
+
+    if (!wait_for_samples(rb, rbr->read_point, num_samples, timeout)) {
+        return false;
+    }
+    if (!check_overrun(rb, rbr, num_samples)) {
+        return false;
+    }
+    update_peak_lag(rb, rbr);
+
+    int read_point_mod = rbr->read_point % rb->buffer_size;
+    auto num_samples_1 = split_at_end(rb, read_point_mod, num_samples);
+    for (int i = 0; i < num_areas; ++i) {
+        sample_decode(rb->format, sample_ptr(rb, i, read_point_mod), rb->step, num_samples_1, out[i]);
+        sample_decode(rb->format, sample_ptr(rb, i, 0), rb->step, num_samples - num_samples_1, out[i] + num_samples_1);
+    }
+
+    set_read_point(rb, rbr, rbr->read_point + num_samples);
+    return true;
+}
+
 void ring_buffer_destroy(RingBufferState* rb) {
-    delete[] rb->buffer;
+    if (rb->mode == RING_BUFFER_HEAP) {
+        delete[] rb->buffer;
+    } else {
+        mirrored_unmap(rb->buffer, buffer_bytes(rb));
+    }
+
+    if (rb->mode == RING_BUFFER_SHARED) {
+        munmap(rb->header, header_bytes());
+        if (rb->shared_name[0]) {
+            shm_unlink(rb->shared_name);
+        }
+    } else {
+        delete rb->header;
+    }
 }
@@ -2,25 +2,188 @@
 #define ring_buffer_hpp
 
 #include <atomic>
+#include <stdint.h>
 #include "Area.hpp"
+#include "sample_format.hpp"
+
+constexpr int RING_BUFFER_MAX_AREAS = 32;
+constexpr int RING_BUFFER_MAX_READERS = 16;
+constexpr long RING_BUFFER_NO_READER = -1;
+
+struct RingBufferReaderState;
+
+// MIRRORED maps the buffer's pages twice in a row, so every read or write
+// of up to buffer_size samples is one contiguous Area, even across the wrap.
+// SHARED is MIRRORED in a named POSIX shared memory segment, see
+// ring_buffer_init_shared and ring_buffer_attach.
+enum RingBufferMode {
+    RING_BUFFER_HEAP,
+    RING_BUFFER_MIRRORED,
+    RING_BUFFER_SHARED
+};
+
+// INTERLEAVED stores the channels frame by frame (areas have step
+// num_areas), PLANAR gives each channel its own contiguous region (step 1)
+enum RingBufferLayout {
+    RING_BUFFER_INTERLEAVED,
+    RING_BUFFER_PLANAR
+};
+
+// Shared memory segment layout (all integers native endian):
+//
+//   0             RingBufferHeader, padded to a whole page
+//   data_offset   the samples, buffer_size * num_areas of them, either
+//                 interleaved by frame or one region per area (planar)
+//
+// write_point counts the frames ever written. The frames from
+// write_point - buffer_size + write_pending up to write_point are intact.
+// Clients keep their own read point and must not write to the samples or
+// to write_point/write_pending. To block for new samples they use the wake
+// fields exactly as ring_buffer.cpp does (wake_seq is a futex word).
+constexpr uint32_t RING_BUFFER_MAGIC = 0x42524d42; // "BMRB"
+constexpr uint32_t RING_BUFFER_VERSION = 2;
+
+struct RingBufferHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t buffer_size; // frames, a power of two
+    int32_t num_areas;
+    int32_t layout;      // RingBufferLayout
+    int32_t format;      // SampleFormat
+    int32_t sample_size; // bytes per sample
+    int64_t data_offset; // bytes from the start of the segment
+
+    std::atomic_long write_point;
+    std::atomic_int write_pending; // size of the block being (or last) written
+
+    // Blocked readers register the write point they're waiting for, and the
+    // writer only signals (bumps wake_seq and wakes them) once it gets there
+    std::atomic_long wake_point;
+    std::atomic_int wake_seq;
+    std::atomic_int num_waiters;
+};
 
 struct RingBufferState {
-    float* buffer;
+    char* buffer;
+    RingBufferHeader* header; // in the shared segment, or on the heap
     int step;
+    int area_offset; // distance between the first samples of two areas
+    int num_areas;
     int buffer_size;
-    std::atomic_long write_point;
+    SampleFormat format;
+    int sample_size;
+    RingBufferMode mode;
+    RingBufferLayout layout;
+    bool read_only;           // attached to another process' buffer
+    char shared_name[64];     // set when this process created the segment
+
+    // Read points of the readers registered with ring_buffer_register_reader,
+    // RING_BUFFER_NO_READER in free slots. The buffer owns these, so lag
+    // reports never touch a reader's own state.
+    std::atomic_long reader_points[RING_BUFFER_MAX_READERS];
+    std::atomic_long backpressure_threshold; // 0 when disabled
+};
+
+// What a reader does when the writer has lapped it
+enum RingBufferOverrunPolicy {
+    RING_BUFFER_SKIP_TO_NEWEST, // drop everything but the newest samples
+    RING_BUFFER_SKIP_TO_OLDEST, // resume at the oldest sample still intact
+    RING_BUFFER_FAIL            // the read fails, the reader restarts at the write point
 };
 
-typedef long RingBufferReaderState;
+struct RingBufferReaderState {
+    long read_point;
+    RingBufferOverrunPolicy overrun_policy;
+    long lost_samples; // total skipped over because of overruns
+    std::atomic_long peak_lag; // most samples ever waiting at a read
+    int slot; // index in RingBufferState::reader_points, -1 if not registered
+};
 
-void ring_buffer_init(RingBufferState* rb, int buffer_size, int num_areas = 1);
-void ring_buffer_start_write(RingBufferState* rb, int num_samples, int num_areas, Area* areas);
-Area ring_buffer_start_write(RingBufferState* rb, int num_samples);
+// Samples are stored in format, integer formats take less memory but can
+// only be read through the converting reads below. The Area based
+// (zero-copy) writes and reads need SAMPLE_FORMAT_FLOAT32.
+void ring_buffer_init(RingBufferState* rb, int buffer_size, int num_areas = 1, RingBufferMode mode = RING_BUFFER_HEAP, RingBufferLayout layout = RING_BUFFER_INTERLEAVED, SampleFormat format = SAMPLE_FORMAT_FLOAT32);
+
+// Creates a buffer in the POSIX shared memory segment name (e.g.
+// "/bmjap.input"), replacing a stale one. The segment is unlinked again by
+// ring_buffer_destroy. Returns false (leaving rb uninitialised) on failure.
+bool ring_buffer_init_shared(RingBufferState* rb, const char* name, int buffer_size, int num_areas = 1, RingBufferLayout layout = RING_BUFFER_INTERLEAVED, SampleFormat format = SAMPLE_FORMAT_FLOAT32);
+
+// Attaches to a buffer shared by another process. The samples are mapped
+// read only, readers work as usual but writes aren't allowed.
+bool ring_buffer_attach(RingBufferState* rb, const char* name);
+
+// Blocks of any size can be written. The block is returned as one segment
+// (areas), or as two when it wraps around the end of a heap buffer
+// (areas_wrapped then continues at the start). Returns the segment count.
+int ring_buffer_start_write(RingBufferState* rb, int num_samples, int num_areas, Area* areas, Area* areas_wrapped);
+int ring_buffer_start_write(RingBufferState* rb, int num_samples, Area* area, Area* area_wrapped);
 void ring_buffer_end_write(RingBufferState* rb, int num_samples);
-void ring_buffer_reader_init(RingBufferState* rb, RingBufferReaderState* rbr);
+
+// Copies in (one area per channel) into the buffer, converting to the
+// buffer's format, and ends the write
+void ring_buffer_write(RingBufferState* rb, int num_samples, int num_areas, Area* in);
+
+void ring_buffer_reader_init(RingBufferState* rb, RingBufferReaderState* rbr, RingBufferOverrunPolicy overrun_policy = RING_BUFFER_SKIP_TO_NEWEST);
+void ring_buffer_reader_init_at(RingBufferReaderState* rbr, long read_point, RingBufferOverrunPolicy overrun_policy = RING_BUFFER_SKIP_TO_NEWEST);
+long ring_buffer_reader_lost_samples(RingBufferReaderState* rbr);
+
+// Registered readers publish their read point into a slot of the buffer,
+// which can then report how far behind they are. Returns false if all
+// RING_BUFFER_MAX_READERS are taken. Register and unregister from the
+// thread that reads through the reader, or while no read on it can be
+// running (before that thread starts, after it stops). Once unregistered
+// the reader state can go away even while another thread is asking for
+// the lag.
+bool ring_buffer_register_reader(RingBufferState* rb, RingBufferReaderState* rbr);
+void ring_buffer_unregister_reader(RingBufferState* rb, RingBufferReaderState* rbr);
+
+// Samples written but not yet read by this reader (can exceed buffer_size
+// when it has been lapped)
+long ring_buffer_reader_fill(RingBufferState* rb, RingBufferReaderState* rbr);
+long ring_buffer_reader_peak_lag(RingBufferReaderState* rbr);
+
+// Fill level of the registered reader furthest behind, 0 if there are none.
+// Only the buffer's registry slots are read, so this is safe from any thread
+// (e.g. the producer), unlike ring_buffer_reader_fill.
+long ring_buffer_slowest_lag(RingBufferState* rb);
+
+// Backpressure: once set, ring_buffer_backpressure says whether the slowest
+// registered reader is threshold_samples or more behind, so a producer that
+// can wait (e.g. a file feeder) can hold off instead of lapping it.
+// A threshold of 0 turns it off.
+void ring_buffer_set_backpressure(RingBufferState* rb, long threshold_samples);
+bool ring_buffer_backpressure(RingBufferState* rb);
 bool ring_buffer_can_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples);
-void ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas);
+
+// All reads check for overruns first and apply the reader's overrun policy.
+// They only return false (and empty areas) under RING_BUFFER_FAIL.
+
+// Blocks until num_samples are available
+bool ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas);
 Area ring_buffer_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples);
+
+// Return false straight away if num_samples aren't available yet
+bool ring_buffer_try_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* areas);
+bool ring_buffer_try_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, Area* area);
+
+// Return false if num_samples didn't become available within timeout
+bool ring_buffer_timed_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, double timeout, int num_areas, Area* areas);
+bool ring_buffer_timed_read(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, double timeout, Area* area);
+
+// Zero-copy access to the samples [start, start + num_samples) without a
+// reader. Returns false if they aren't all written and intact, or if they
+// wrap around the end of a heap buffer. The writer doesn't wait for anyone,
+// so check ring_buffer_span_intact once done with the areas to find out if
+// they were overwritten in the meantime.
+bool ring_buffer_peek(RingBufferState* rb, long start, int num_samples, int num_areas, Area* areas);
+bool ring_buffer_span_intact(RingBufferState* rb, long start, int num_samples);
+
+// Converting reads work with any format: num_samples are converted to float
+// into out (one area per channel), never cut short at the end of the buffer
+bool ring_buffer_read_convert(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, int num_areas, Area* out);
+bool ring_buffer_timed_read_convert(RingBufferState* rb, RingBufferReaderState* rbr, int num_samples, double timeout, int num_areas, Area* out);
+
 void ring_buffer_destroy(RingBufferState* rb);
 
 #endif
@@ -0,0 +1,123 @@
+#include "sample_format.hpp"
+#include <stdint.h>
+
+// Codecs for one stored sample. The loops below are written over plain
+// pointers with the unit-step case split out, so the compiler can
+// vectorize the common planar/mono paths.
+template <SampleFormat F>
+struct SampleCodec;
+
+template <>
+struct SampleCodec<SAMPLE_FORMAT_FLOAT32> {
+    typedef float stored_t;
+    static constexpr int size = 4;
+    static void encode(float x, stored_t* out) {
+        *out = x;
+    }
+    static float decode(const stored_t* in) {
+        return *in;
+    }
+};
+
+template <>
+struct SampleCodec<SAMPLE_FORMAT_INT16> {
+    typedef int16_t stored_t;
+    static constexpr int size = 2;
+    static void encode(float x, stored_t* out) {
+        x = x < -1.0f ? -1.0f : x > 1.0f ? 1.0f : x;
+        *out = (int16_t)(x * 32767.0f + (x < 0.0f ? -0.5f : 0.5f));
+    }
+    static float decode(const stored_t* in) {
+        return *in * (1.0f / 32767.0f);
+    }
+};
+
+template <>
+struct SampleCodec<SAMPLE_FORMAT_INT24> {
+    typedef uint8_t stored_t; // 3 per sample
+    static constexpr int size = 3;
+    static void encode(float x, stored_t* out) {
+        x = x < -1.0f ? -1.0f : x > 1.0f ? 1.0f : x;
+        auto v = (int32_t)(x * 8388607.0f + (x < 0.0f ? -0.5f : 0.5f));
+        out[0] = (uint8_t)v;
+        out[1] = (uint8_t)(v >> 8);
+        out[2] = (uint8_t)(v >> 16);
+    }
+    static float decode(const stored_t* in) {
+        auto u = (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16;
+        auto v = (int32_t)(u << 8) >> 8; // sign extend, shifting unsigned
+        return v * (1.0f / 8388607.0f);
+    }
+};
+
+template <SampleFormat F>
+static void encode(Area in, void* out, int step) {
+    typedef SampleCodec<F> C;
+    auto ptr_out = (typename C::stored_t*)out;
+    auto stride = step * C::size / (int)sizeof(typename C::stored_t);
+    auto num_samples = in.num_samples();
+
+    if (in.step == 1 && step == 1) {
+        auto ptr_in = in.ptr;
+        for (int i = 0; i < num_samples; ++i) {
+            C::encode(ptr_in[i], ptr_out + i * stride);
+        }
+        return;
+    }
+    for (int i = 0; i < num_samples; ++i) {
+        C::encode(in.ptr[i * in.step], ptr_out + i * stride);
+    }
+}
+
+template <SampleFormat F>
+static void decode(const void* in, int step, int num_samples, Area out) {
+    typedef SampleCodec<F> C;
+    auto ptr_in = (const typename C::stored_t*)in;
+    auto stride = step * C::size / (int)sizeof(typename C::stored_t);
+    if (num_samples > out.num_samples()) {
+        num_samples = out.num_samples();
+    }
+
+    if (out.step == 1 && step == 1) {
+        auto ptr_out = out.ptr;
+        for (int i = 0; i < num_samples; ++i) {
+            ptr_out[i] = C::decode(ptr_in + i * stride);
+        }
+        return;
+    }
+    for (int i = 0; i < num_samples; ++i) {
+        out.ptr[i * out.step] = C::decode(ptr_in + i * stride);
+    }
+}
+
+int sample_format_size(SampleFormat format) {
+    switch (format) {
+        case SAMPLE_FORMAT_INT16: return SampleCodec<SAMPLE_FORMAT_INT16>::size;
+        case SAMPLE_FORMAT_INT24: return SampleCodec<SAMPLE_FORMAT_INT24>::size;
+        case SAMPLE_FORMAT_FLOAT32:
+        default:
+            return SampleCodec<SAMPLE_FORMAT_FLOAT32>::size;
+    }
+}
+
+void sample_encode(SampleFormat format, Area in, void* out, int step) {
+    switch (format) {
+        case SAMPLE_FORMAT_INT16: encode<SAMPLE_FORMAT_INT16>(in, out, step); break;
+        case SAMPLE_FORMAT_INT24: encode<SAMPLE_FORMAT_INT24>(in, out, step); break;
+        case SAMPLE_FORMAT_FLOAT32:
+        default:
+            encode<SAMPLE_FORMAT_FLOAT32>(in, out, step);
+            break;
+    }
+}
+
+void sample_decode(SampleFormat format, const void* in, int step, int num_samples, Area out) {
+    switch (format) {
+        case SAMPLE_FORMAT_INT16: decode<SAMPLE_FORMAT_INT16>(in, step, num_samples, out); break;
+        case SAMPLE_FORMAT_INT24: decode<SAMPLE_FORMAT_INT24>(in, step, num_samples, out); break;
+        case SAMPLE_FORMAT_FLOAT32:
+        default:
+            decode<SAMPLE_FORMAT_FLOAT32>(in, step, num_samples, out);
+            break;
+    }
+}
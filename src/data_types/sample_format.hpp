@@ -0,0 +1,22 @@
+#ifndef sample_format_hpp
+#define sample_format_hpp
+
+#include "Area.hpp"
+
+// How samples are stored. Everything outside storage works in float, the
+// integer formats are converted on the way in and out (full scale = 1.0).
+enum SampleFormat {
+    SAMPLE_FORMAT_FLOAT32,
+    SAMPLE_FORMAT_INT16,
+    SAMPLE_FORMAT_INT24 // packed, 3 bytes little endian
+};
+
+int sample_format_size(SampleFormat format);
+
+// Converts the samples of in and stores them at out, step samples apart
+void sample_encode(SampleFormat format, Area in, void* out, int step);
+
+// Converts num_samples stored at in, step samples apart, into out
+void sample_decode(SampleFormat format, const void* in, int step, int num_samples, Area out);
+
+#endif
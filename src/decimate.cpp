@@ -0,0 +1,85 @@
+#include "decimate.hpp"
+#include <assert.h>
+#include <cmath>
+
+void decimate_init(DecimateState* state, int factor, int max_in_length) {
+    assert(factor == 1 || factor == 2 || factor == 4 || factor == 8);
+
+    state->factor = factor;
+    state->num_stages = factor == 8 ? 3 : factor == 4 ? 2 : factor == 2 ? 1 : 0;
+    state->max_in_length = max_in_length;
+
+    // Blackman windowed sinc with its cutoff at half the band. The even
+    // offsets of a halfband filter are all zero, except 0.5 in the middle.
+    double sum = 0.0;
+    for (int i = 0; i < DECIMATE_HALFBAND_PAIRS; ++i) {
+        auto j = 2 * i + 1;
+        auto x = M_PI * j / (2.0 * DECIMATE_HALFBAND_PAIRS + 1.0);
+        auto window = 0.42 + 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+        auto tap = sin(M_PI * j / 2.0) / (M_PI * j) * window;
+        state->taps[i] = (float)tap;
+        sum += 2.0 * tap;
+    }
+
+    // ... unity gain at DC
+    for (int i = 0; i < DECIMATE_HALFBAND_PAIRS; ++i) {
+        state->taps[i] = (float)(state->taps[i] * 0.5 / sum);
+    }
+
+    state->data = new float[max_in_length];
+}
+
+// y[i] = 0.5 x[2i] + sum over odd j of taps(j) (x[2i - j] + x[2i + j]),
+// with zeros outside the window
+static void halfband_stage(const float* taps, Area in, float* out, int num_out) {
+    auto n = in.num_samples();
+    auto x = in.ptr;
+    auto step = in.step;
+    constexpr int REACH = 2 * DECIMATE_HALFBAND_PAIRS - 1;
+
+    for (int i = 0; i < num_out; ++i) {
+        auto centre = 2 * i;
+        auto sum = 0.5f * x[centre * step];
+
+        // The whole filter fits in the window, so skip the bounds checks
+        if (centre - REACH >= 0 && centre + REACH < n) {
+            auto ptr = x + centre * step;
+            for (int k = 0; k < DECIMATE_HALFBAND_PAIRS; ++k) {
+                auto j = (2 * k + 1) * step;
+                sum += taps[k] * (ptr[-j] + ptr[j]);
+            }
+        } else {
+            for (int k = 0; k < DECIMATE_HALFBAND_PAIRS; ++k) {
+                auto j = 2 * k + 1;
+                auto left = centre - j >= 0 ? x[(centre - j) * step] : 0.0f;
+                auto right = centre + j < n ? x[(centre + j) * step] : 0.0f;
+                sum += taps[k] * (left + right);
+            }
+        }
+        out[i] = sum;
+    }
+}
+
+void decimate_compute(DecimateState* state, Area in, Area* out) {
+    assert(in.num_samples() <= state->max_in_length);
+
+    if (state->num_stages == 0) {
+        *out = in;
+        return;
+    }
+
+    // Stage outputs are stored one after the other
+    auto stage_in = in;
+    auto ptr_out = state->data;
+    for (int stage = 0; stage < state->num_stages; ++stage) {
+        auto num_out = stage_in.num_samples() / 2;
+        halfband_stage(state->taps, stage_in, ptr_out, num_out);
+        stage_in = Area(ptr_out, num_out, 1);
+        ptr_out += num_out;
+    }
+    *out = stage_in;
+}
+
+void decimate_destroy(DecimateState* state) {
+    delete[] state->data;
+}
@@ -0,0 +1,31 @@
+#ifndef decimate_hpp
+#define decimate_hpp
+
+#include "data_types/Area.hpp"
+
+// Anti-aliased decimation of a whole window by 2, 4 or 8, as a cascade of
+// halfband FIR stages. Each stage only computes every other output and
+// half of the halfband taps are zero, so a stage costs about
+// DECIMATE_HALFBAND_PAIRS multiplies per output sample. The filters are
+// zero phase, so output sample i lines up with input sample i * factor.
+// Each stage is flat up to 0.4 of its output rate and rejects (> 50 dB)
+// everything that would alias back into that band.
+
+constexpr int DECIMATE_MAX_FACTOR = 8;
+constexpr int DECIMATE_HALFBAND_PAIRS = 11;
+
+struct DecimateState {
+    int factor;
+    int num_stages;
+    int max_in_length;
+    float taps[DECIMATE_HALFBAND_PAIRS]; // for the odd offsets 1, 3, 5...
+    float* data;                          // every stage's output
+};
+
+void decimate_init(DecimateState* state, int factor, int max_in_length);
+
+// out points into the state, in.num_samples() / factor samples long
+void decimate_compute(DecimateState* state, Area in, Area* out);
+void decimate_destroy(DecimateState* state);
+
+#endif
@@ -2,34 +2,167 @@
 #include <fftw3/fftw3.h>
 #include <cmath>
 #include <string.h>
+#include <string>
+#include <mutex>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The FFTW planner is not thread-safe, only fftw_execute is
+static std::mutex planner_mutex;
+static std::string wisdom_directory;
+
+// Maps a sample type onto the matching FFTW API (fftwf_* or fftw_*)
+template <typename T>
+struct FFTW;
+
+template <>
+struct FFTW<float> {
+    typedef fftwf_complex complex;
+    typedef fftwf_plan plan;
+    static void* malloc(size_t size) { return fftwf_malloc(size); }
+    static void free(void* ptr) { fftwf_free(ptr); }
+    static plan plan_r2c(int n, int howmany, float* in, complex* out, unsigned flags) {
+        return fftwf_plan_many_dft_r2c(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n / 2 + 1, flags);
+    }
+    static plan plan_c2r(int n, int howmany, complex* in, float* out, unsigned flags) {
+        return fftwf_plan_many_dft_c2r(1, &n, howmany, in, NULL, 1, n / 2 + 1, out, NULL, 1, n, flags);
+    }
+    static void execute(plan p) { fftwf_execute(p); }
+    static void destroy_plan(plan p) { fftwf_destroy_plan(p); }
+    static int import_wisdom(const char* file_name) { return fftwf_import_wisdom_from_filename(file_name); }
+    static int export_wisdom(const char* file_name) { return fftwf_export_wisdom_to_filename(file_name); }
+    static const char* wisdom_file_name() { return "fftwf.wisdom"; }
+};
+
+template <>
+struct FFTW<double> {
+    typedef fftw_complex complex;
+    typedef fftw_plan plan;
+    static void* malloc(size_t size) { return fftw_malloc(size); }
+    static void free(void* ptr) { fftw_free(ptr); }
+    static plan plan_r2c(int n, int howmany, double* in, complex* out, unsigned flags) {
+        return fftw_plan_many_dft_r2c(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n / 2 + 1, flags);
+    }
+    static plan plan_c2r(int n, int howmany, complex* in, double* out, unsigned flags) {
+        return fftw_plan_many_dft_c2r(1, &n, howmany, in, NULL, 1, n / 2 + 1, out, NULL, 1, n, flags);
+    }
+    static void execute(plan p) { fftw_execute(p); }
+    static void destroy_plan(plan p) { fftw_destroy_plan(p); }
+    static int import_wisdom(const char* file_name) { return fftw_import_wisdom_from_filename(file_name); }
+    static int export_wisdom(const char* file_name) { return fftw_export_wisdom_to_filename(file_name); }
+    static const char* wisdom_file_name() { return "fftw.wisdom"; }
+};
+
+template <typename T>
+struct FFTBuffers {
+    T* buf_real;                             // N real samples per window
+    typename FFTW<T>::complex* buf_complex;  // N / 2 + 1 bins of the half spectrum per window
+    typename FFTW<T>::plan plan_1;
+    typename FFTW<T>::plan plan_2;
+};
 
 struct FFTState {
     int window_length;
     int N;
-    fftw_complex* buf_A;
-    fftw_complex* buf_B;
-    fftw_plan plan_1;
-    fftw_plan plan_2;
+    int batch_size;
+    FFTPrecision precision;
+    float* hann;          // analysis window for fft_spectrum
+    float spectrum_scale; // 2 / the sum of hann
+    FFTBuffers<float> buffers_float;
+    FFTBuffers<double> buffers_double;
 };
 
-FFTState* fft_init(int window_length) {
+int fft_transform_size(int window_length) {
+    // Zero padded to at least twice the window so the autocorrelation is
+    // linear rather than circular
+    return (int)exp2(ceil(log2(2 * window_length)));
+}
+
+// Called with the planner mutex held
+template <typename T>
+static void wisdom_save() {
+    if (wisdom_directory.empty()) {
+        return;
+    }
+
+    // Write to a temporary file first so concurrent processes never load
+    // a half-written cache
+    auto file_name = wisdom_directory + "/" + FFTW<T>::wisdom_file_name();
+    auto tmp_file_name = file_name + "." + std::to_string((long)getpid());
+    if (!FFTW<T>::export_wisdom(tmp_file_name.c_str())) {
+        fprintf(stderr, "Failed to write FFTW wisdom to %s\n", tmp_file_name.c_str());
+        return;
+    }
+    rename(tmp_file_name.c_str(), file_name.c_str());
+}
+
+// Called with the planner mutex held
+template <typename T>
+static void buffers_init(FFTBuffers<T>* buffers, int N, int batch_size, unsigned flags) {
+    buffers->buf_real    = (T*)FFTW<T>::malloc(sizeof(T) * N * batch_size);
+    buffers->buf_complex = (typename FFTW<T>::complex*)FFTW<T>::malloc(sizeof(typename FFTW<T>::complex) * (N / 2 + 1) * batch_size);
+
+    // Use the cached wisdom if we have it for this size
+    buffers->plan_1 = FFTW<T>::plan_r2c(N, batch_size, buffers->buf_real, buffers->buf_complex, flags | FFTW_WISDOM_ONLY);
+    buffers->plan_2 = FFTW<T>::plan_c2r(N, batch_size, buffers->buf_complex, buffers->buf_real, flags | FFTW_WISDOM_ONLY);
+    if (buffers->plan_1 && buffers->plan_2) {
+        return;
+    }
+
+    if (!buffers->plan_1) {
+        buffers->plan_1 = FFTW<T>::plan_r2c(N, batch_size, buffers->buf_real, buffers->buf_complex, flags);
+    }
+    if (!buffers->plan_2) {
+        buffers->plan_2 = FFTW<T>::plan_c2r(N, batch_size, buffers->buf_complex, buffers->buf_real, flags);
+    }
+    wisdom_save<T>();
+}
+
+template <typename T>
+static void buffers_destroy(FFTBuffers<T>* buffers) {
+    FFTW<T>::destroy_plan(buffers->plan_1);
+    FFTW<T>::destroy_plan(buffers->plan_2);
+    FFTW<T>::free(buffers->buf_real);
+    FFTW<T>::free(buffers->buf_complex);
+}
+
+FFTState* fft_init(int window_length, FFTPrecision precision) {
+    return fft_init_batch(window_length, 1, precision);
+}
+
+FFTState* fft_init_batch(int window_length, int batch_size, FFTPrecision precision) {
     auto state = new FFTState;
 
     state->window_length = window_length;
-    state->N = (int)exp2(ceil(log2(window_length)));
+    state->N = fft_transform_size(window_length);
+    state->batch_size = batch_size;
+    state->precision = precision;
+
+    state->hann = new float[window_length];
+    double sum = 0.0;
+    for (int i = 0; i < window_length; ++i) {
+        state->hann[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / window_length));
+        sum += state->hann[i];
+    }
+    state->spectrum_scale = (float)(2.0 / sum);
 
-    state->buf_A = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * state->N);
-    state->buf_B = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * state->N);
-    state->plan_1 = fftw_plan_dft_1d(state->N, state->buf_A, state->buf_B, FFTW_FORWARD,  FFTW_MEASURE);
-    state->plan_2 = fftw_plan_dft_1d(state->N, state->buf_B, state->buf_A, FFTW_BACKWARD, FFTW_MEASURE);
+    std::lock_guard<std::mutex> lg(planner_mutex);
+    if (precision == FFT_PRECISION_FLOAT) {
+        buffers_init(&state->buffers_float, state->N, batch_size, FFTW_MEASURE);
+    } else {
+        buffers_init(&state->buffers_double, state->N, batch_size, FFTW_MEASURE);
+    }
     
     return state;
 }
 
-void fft_compute(FFTState* state, Area in, Area out) {
+template <typename T>
+static void fill_window(T* buf_real, int N, Area in) {
 
     // ... determine input scalar
-    double scalar = 1.0;
+    T scalar = 1.0;
     {
         auto ptr = in;
         auto max = *ptr;
@@ -39,36 +172,53 @@ void fft_compute(FFTState* state, Area in, Area out) {
             }
         }
         if (max != 0.0) {
-            scalar = 1.0 / (double)max;
+            scalar = (T)1.0 / (T)max;
         }
     }
 
     // ... fill in with data
     {
-        auto ptr     = state->buf_A;
-        auto ptr_end = state->buf_A + state->N;
-        // Copy the window into our double array
+        auto ptr     = buf_real;
+        auto ptr_end = buf_real + N;
+        // Copy the window into our real array
         while (in < in.end) {
-            (*ptr)[0] = *in++ * scalar;
-            (*ptr)[1] = 0.0;
-            ptr++;
+            *ptr++ = *in++ * scalar;
         }
         // Zero pad the input
         while (ptr < ptr_end) {
-            (*ptr)[0] = 0.0;
-            (*ptr)[1] = 0.0;
-            ptr++;
+            *ptr++ = 0.0;
         }
     }
+}
+
+template <typename T>
+static void write_window(const T* buf_real, Area out) {
+    auto ptr_in = buf_real;
+    auto ptr_out = out;
+    auto max = buf_real[0]; // the first sample is the max
+    auto scalar = max > 0.0 ? (T)1.0 / max : (T)0.0;
+    while (ptr_out < ptr_out.end) {
+        *ptr_out++ = *ptr_in++ * scalar;
+    }
+}
+
+template <typename T>
+static void compute(FFTBuffers<T>* buffers, int N, int num_windows, const Area* in, Area* out) {
+
+    // ... fill in with data (windows past num_windows are left as they are,
+    // the plan transforms them but nobody reads the result)
+    for (int i = 0; i < num_windows; ++i) {
+        fill_window(buffers->buf_real + i * N, N, in[i]);
+    }
 
     // ... execute forward FFT
-    fftw_execute(state->plan_1);
+    FFTW<T>::execute(buffers->plan_1);
 
-    // ... square the output
+    // ... square the output (the half spectrum is all a real signal needs)
     {
-        auto ptr     = state->buf_B;
-        auto ptr_end = state->buf_B + state->N;
-        auto scalar = 1.0 / std::sqrt((double)state->N);
+        auto ptr     = buffers->buf_complex;
+        auto ptr_end = buffers->buf_complex + (N / 2 + 1) * num_windows;
+        auto scalar = (T)1.0 / std::sqrt((T)N);
         for (; ptr < ptr_end; ++ptr) {
             auto real = (*ptr)[0] * scalar;
             auto imag = (*ptr)[1] * scalar;
@@ -78,23 +228,102 @@ void fft_compute(FFTState* state, Area in, Area out) {
     }
 
     // ... execute reverse FFT
-    fftw_execute(state->plan_2);
+    FFTW<T>::execute(buffers->plan_2);
 
     // ... write output
+    for (int i = 0; i < num_windows; ++i) {
+        write_window(buffers->buf_real + i * N, out[i]);
+    }
+}
+
+void fft_compute(FFTState* state, Area in, Area out) {
+    fft_compute_batch(state, 1, &in, &out);
+}
+
+void fft_compute_batch(FFTState* state, int num_windows, const Area* in, Area* out) {
+    assert(num_windows <= state->batch_size);
+
+    if (state->precision == FFT_PRECISION_FLOAT) {
+        compute(&state->buffers_float, state->N, num_windows, in, out);
+    } else {
+        compute(&state->buffers_double, state->N, num_windows, in, out);
+    }
+}
+
+template <typename T>
+static void spectrum(FFTBuffers<T>* buffers, int N, const float* hann, float scale, Area in, Area out) {
+
+    // ... window and zero pad
+    {
+        auto ptr = buffers->buf_real;
+        int i = 0;
+        for (; in < in.end; ++in, ++i) {
+            ptr[i] = *in * hann[i];
+        }
+        for (; i < N; ++i) {
+            ptr[i] = 0.0;
+        }
+    }
+
+    // ... execute forward FFT
+    FFTW<T>::execute(buffers->plan_1);
+
+    // ... write the magnitudes
     {
-        auto ptr_in = state->buf_A;
-        auto ptr_out = out;
-        auto scalar = 1.0 / state->buf_A[0][0]; // the first sample is the max
-        while (ptr_out < ptr_out.end) {
-            *ptr_out++ = (*ptr_in++)[0] * scalar;
+        auto ptr = buffers->buf_complex;
+        auto ptr_end = buffers->buf_complex + N / 2 + 1;
+        for (; ptr < ptr_end && out < out.end; ++ptr, ++out) {
+            *out = (float)std::sqrt((*ptr)[0] * (*ptr)[0] + (*ptr)[1] * (*ptr)[1]) * scale;
         }
     }
 }
 
+void fft_spectrum(FFTState* state, Area in, Area out) {
+    assert(in.num_samples() <= state->window_length);
+
+    if (state->precision == FFT_PRECISION_FLOAT) {
+        spectrum(&state->buffers_float, state->N, state->hann, state->spectrum_scale, in, out);
+    } else {
+        spectrum(&state->buffers_double, state->N, state->hann, state->spectrum_scale, in, out);
+    }
+}
+
 void fft_destroy(FFTState* state) {
-    fftw_destroy_plan(state->plan_1);
-    fftw_destroy_plan(state->plan_2);
-    fftw_free(state->buf_A);
-    fftw_free(state->buf_B);
+    std::lock_guard<std::mutex> lg(planner_mutex);
+    if (state->precision == FFT_PRECISION_FLOAT) {
+        buffers_destroy(&state->buffers_float);
+    } else {
+        buffers_destroy(&state->buffers_double);
+    }
+    delete[] state->hann;
     delete state;
 }
+
+void fft_wisdom_set_cache(const char* directory) {
+    std::lock_guard<std::mutex> lg(planner_mutex);
+
+    wisdom_directory = directory;
+    mkdir(directory, 0755);
+
+    // A missing cache file just means we start from scratch
+    FFTW<float>::import_wisdom((wisdom_directory + "/" + FFTW<float>::wisdom_file_name()).c_str());
+    FFTW<double>::import_wisdom((wisdom_directory + "/" + FFTW<double>::wisdom_file_name()).c_str());
+}
+
+template <typename T>
+static void prewarm(int window_length) {
+    FFTBuffers<T> buffers;
+    buffers_init(&buffers, fft_transform_size(window_length), 1, FFTW_PATIENT);
+    buffers_destroy(&buffers);
+}
+
+void fft_wisdom_prewarm(const int* window_lengths, int num_window_lengths, FFTPrecision precision) {
+    std::lock_guard<std::mutex> lg(planner_mutex);
+    for (int i = 0; i < num_window_lengths; ++i) {
+        if (precision == FFT_PRECISION_FLOAT) {
+            prewarm<float>(window_lengths[i]);
+        } else {
+            prewarm<double>(window_lengths[i]);
+        }
+    }
+}
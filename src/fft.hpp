@@ -5,8 +5,39 @@
 
 struct FFTState;
 
-FFTState* fft_init(int window_length);
+// Single precision (fftwf) is the default; double precision (fftw) trades
+// twice the memory traffic for accuracy on very long windows
+enum FFTPrecision {
+    FFT_PRECISION_FLOAT,
+    FFT_PRECISION_DOUBLE
+};
+
+// Size of the (zero padded) transform used for a window of window_length
+int fft_transform_size(int window_length);
+
+FFTState* fft_init(int window_length, FFTPrecision precision = FFT_PRECISION_FLOAT);
 void fft_compute(FFTState* state, Area in, Area out);
 void fft_destroy(FFTState* state);
 
+// Magnitude spectrum of a Hann windowed window, through the same forward
+// plan. out gets up to fft_transform_size(window_length) / 2 + 1 bins of
+// sample_rate / fft_transform_size(window_length) Hz each, scaled so a full
+// scale sine peaks at about 1.
+void fft_spectrum(FFTState* state, Area in, Area out);
+
+// Batched variant: one plan transforms up to batch_size windows (e.g. one
+// per channel) stored back to back, which amortises plan dispatch and keeps
+// the working set together. fft_init is a batch of one.
+FFTState* fft_init_batch(int window_length, int batch_size, FFTPrecision precision = FFT_PRECISION_FLOAT);
+void fft_compute_batch(FFTState* state, int num_windows, const Area* in, Area* out);
+
+// Planner wisdom is loaded from, and new wisdom saved to, one cache file per
+// precision in directory. Wisdom is keyed by transform size and direction,
+// so later runs skip the FFTW_MEASURE benchmarking for every known size.
+void fft_wisdom_set_cache(const char* directory);
+
+// Plans the autocorrelation transforms for each window length with
+// FFTW_PATIENT and stores the result in the wisdom cache
+void fft_wisdom_prewarm(const int* window_lengths, int num_window_lengths, FFTPrecision precision);
+
 #endif
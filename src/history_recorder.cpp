@@ -0,0 +1,175 @@
+#include "history_recorder.hpp"
+#include "data_types/mirrored_memory.hpp"
+#include <assert.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void* history_recorder_thread(void* ptr);
+
+static size_t area_bytes(HistoryRecorderState* state) {
+    return sizeof(float) * state->capacity;
+}
+
+static float* area_ptr(HistoryRecorderState* state, int area, long count) {
+    return state->data + 2 * area * state->capacity + count % state->capacity;
+}
+
+bool history_recorder_init(HistoryRecorderState* state, RingBufferState* ring_buffer, const char* path, double history_time, int sample_rate, double segment_time) {
+
+    // The file is mirrored, so each area has to be a whole number of pages
+    auto page_samples = (long)(mirrored_page_size() / sizeof(float));
+    auto capacity = (long)(history_time * sample_rate);
+    capacity = (capacity + page_samples - 1) / page_samples * page_samples;
+
+    state->ring_buffer = ring_buffer;
+    state->num_areas = ring_buffer->num_areas;
+    state->segment_length = (int)(segment_time * sample_rate);
+    if (state->segment_length > ring_buffer->buffer_size / 2) {
+        state->segment_length = ring_buffer->buffer_size / 2;
+    }
+    state->capacity = capacity;
+    state->start_count = 0;
+    state->end_count = 0;
+    state->lost_samples = 0;
+    state->running = false;
+
+    state->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (state->fd == -1) {
+        fprintf(stderr, "Failed to open history file %s\n", path);
+        return false;
+    }
+    if (ftruncate(state->fd, (off_t)(area_bytes(state) * state->num_areas)) != 0) {
+        fprintf(stderr, "Failed to size history file %s\n", path);
+        close(state->fd);
+        return false;
+    }
+    state->data = (float*)mirrored_map_many(state->fd, 0, area_bytes(state), state->num_areas, PROT_READ | PROT_WRITE);
+    if (!state->data) {
+        fprintf(stderr, "Failed to map history file %s\n", path);
+        close(state->fd);
+        return false;
+    }
+    state->segment = new float[state->segment_length * state->num_areas];
+
+    // Start with the oldest samples still in the ring
+    auto write_point = ring_buffer->header->write_point.load();
+    auto read_point = write_point > ring_buffer->buffer_size / 2 ? write_point - ring_buffer->buffer_size / 2 : 0;
+    ring_buffer_reader_init_at(&state->reader, read_point, RING_BUFFER_SKIP_TO_OLDEST);
+    state->start_count = read_point;
+    state->end_count = read_point;
+
+    return true;
+}
+
+void history_recorder_start(HistoryRecorderState* state) {
+    state->running = true;
+    pthread_create(&state->thread, NULL, history_recorder_thread, state);
+}
+
+void history_recorder_stop(HistoryRecorderState* state) {
+    if (state->running) {
+        state->running = false;
+        pthread_join(state->thread, NULL);
+    }
+}
+
+void history_recorder_destroy(HistoryRecorderState* state) {
+    mirrored_unmap(state->data, area_bytes(state) * state->num_areas);
+    close(state->fd);
+    delete[] state->segment;
+}
+
+// Appends num_samples from in (or zeros if in is null) to the history
+static void append(HistoryRecorderState* state, int num_samples, Area* in) {
+    auto end_count = state->end_count.load();
+
+    // Retire what is about to be overwritten before touching it
+    if (end_count + num_samples - state->capacity > state->start_count.load()) {
+        state->start_count = end_count + num_samples - state->capacity;
+    }
+
+    for (int i = 0; i < state->num_areas; ++i) {
+        auto out = Area(area_ptr(state, i, end_count), num_samples, 1);
+        if (in) {
+            Area::copy_over(in[i], out);
+        } else {
+            while (out < out.end) {
+                *out++ = 0.0f;
+            }
+        }
+    }
+
+    state->end_count = end_count + num_samples;
+}
+
+void* history_recorder_thread(void* ptr) {
+    auto state = (HistoryRecorderState*)ptr;
+
+    // Wake up now and then to notice history_recorder_stop
+    constexpr double READ_TIMEOUT = 0.1;
+
+    // The reader is registered only while this thread reads through it
+    ring_buffer_register_reader(state->ring_buffer, &state->reader);
+
+    auto lost_samples = ring_buffer_reader_lost_samples(&state->reader);
+
+    Area areas[RING_BUFFER_MAX_AREAS];
+    for (int i = 0; i < state->num_areas; ++i) {
+        areas[i] = Area(state->segment + i * state->segment_length, state->segment_length, 1);
+    }
+
+    while (state->running.load()) {
+        if (!ring_buffer_timed_read_convert(state->ring_buffer, &state->reader, state->segment_length, READ_TIMEOUT, state->num_areas, areas)) {
+            continue;
+        }
+
+        // Keep indices aligned with the ring buffer across overruns by
+        // filling the samples we missed with silence
+        auto new_lost_samples = ring_buffer_reader_lost_samples(&state->reader);
+        if (new_lost_samples != lost_samples) {
+            auto gap = new_lost_samples - lost_samples;
+            lost_samples = new_lost_samples;
+            state->lost_samples += gap;
+
+            auto read_start = state->reader.read_point - areas[0].num_samples();
+            if (read_start - state->end_count.load() > state->capacity) {
+                state->start_count = read_start;
+                state->end_count = read_start;
+            }
+            while (state->end_count.load() < read_start) {
+                auto num_samples = read_start - state->end_count.load();
+                append(state, (int)(num_samples < state->segment_length ? num_samples : state->segment_length), NULL);
+            }
+        }
+
+        append(state, areas[0].num_samples(), areas);
+    }
+
+    // Spill the last partial segment
+    auto remaining = (int)ring_buffer_reader_fill(state->ring_buffer, &state->reader);
+    if (remaining > 0 && remaining < state->segment_length &&
+        ring_buffer_timed_read_convert(state->ring_buffer, &state->reader, remaining, 0.0, state->num_areas, areas)) {
+        append(state, remaining, areas);
+    }
+
+    ring_buffer_unregister_reader(state->ring_buffer, &state->reader);
+    return NULL;
+}
+
+bool history_recorder_read(HistoryRecorderState* state, long from, int num_samples, int num_areas, Area* out) {
+    assert(num_areas <= state->num_areas);
+    assert(num_samples <= state->capacity);
+
+    if (from < state->start_count.load() || from + num_samples > state->end_count.load()) {
+        return false;
+    }
+
+    for (int i = 0; i < num_areas; ++i) {
+        Area::copy_over(Area(area_ptr(state, i, from), num_samples, 1), out[i]);
+    }
+
+    // The recorder may have overwritten the start while we were copying
+    return from >= state->start_count.load();
+}
@@ -0,0 +1,46 @@
+#ifndef history_recorder_hpp
+#define history_recorder_hpp
+
+#include <atomic>
+#include <pthread.h>
+#include "data_types/Area.hpp"
+#include "data_types/ring_buffer.hpp"
+
+// Keeps a long history (minutes to hours) of a ring buffer in a memory
+// mapped file. A background thread reads the ring as a registered reader
+// and spills it into the file segment by segment, so the audio callback
+// never waits on the disk. The file is circular, one region per area, and
+// samples are addressed by their absolute index in the ring buffer.
+struct HistoryRecorderState {
+    RingBufferState* ring_buffer;
+    RingBufferReaderState reader;
+    int num_areas;
+    int segment_length;
+    long capacity; // samples per area kept in the file
+
+    float* segment; // converted samples on their way to the file
+
+    int fd;
+    float* data; // area i starts at data + 2 * i * capacity (mirrored)
+
+    // History covers [start_count, end_count)
+    std::atomic_long start_count;
+    std::atomic_long end_count;
+    std::atomic_long lost_samples; // zero filled after ring buffer overruns
+
+    pthread_t thread;
+    std::atomic_bool running;
+};
+
+// Creates (or truncates) the file at path. Returns false on failure.
+bool history_recorder_init(HistoryRecorderState* state, RingBufferState* ring_buffer, const char* path, double history_time, int sample_rate, double segment_time = 0.5);
+void history_recorder_start(HistoryRecorderState* state);
+void history_recorder_stop(HistoryRecorderState* state);
+void history_recorder_destroy(HistoryRecorderState* state);
+
+// Copies num_samples starting at absolute index from into out (one area
+// per ring buffer area). Returns false if part of the range isn't in the
+// history, either not recorded yet or already overwritten.
+bool history_recorder_read(HistoryRecorderState* state, long from, int num_samples, int num_areas, Area* out);
+
+#endif
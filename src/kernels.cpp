@@ -0,0 +1,88 @@
+#include "kernels.hpp"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define KERNELS_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KERNELS_NEON
+#endif
+
+float dot_product(const float* a, const float* b, int n) {
+    int i = 0;
+    float sum = 0.0f;
+
+#if defined(KERNELS_SSE)
+    auto acc_1 = _mm_setzero_ps();
+    auto acc_2 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc_1 = _mm_add_ps(acc_1, _mm_mul_ps(_mm_loadu_ps(a + i),     _mm_loadu_ps(b + i)));
+        acc_2 = _mm_add_ps(acc_2, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc_1, acc_2));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(KERNELS_NEON)
+    auto acc_1 = vdupq_n_f32(0.0f);
+    auto acc_2 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= n; i += 8) {
+        acc_1 = vmlaq_f32(acc_1, vld1q_f32(a + i),     vld1q_f32(b + i));
+        acc_2 = vmlaq_f32(acc_2, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    auto acc = vaddq_f32(acc_1, acc_2);
+    sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#endif
+
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+float sliding_difference(const float* a, const float* a_lag, const float* b, const float* b_lag, int n) {
+    int i = 0;
+    float sum = 0.0f;
+
+#if defined(KERNELS_SSE)
+    auto acc_1 = _mm_setzero_ps();
+    auto acc_2 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        auto d_a = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(a_lag + i));
+        auto d_b = _mm_sub_ps(_mm_loadu_ps(b + i), _mm_loadu_ps(b_lag + i));
+        acc_1 = _mm_add_ps(acc_1, _mm_mul_ps(d_a, d_a));
+        acc_2 = _mm_add_ps(acc_2, _mm_mul_ps(d_b, d_b));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_sub_ps(acc_1, acc_2));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(KERNELS_NEON)
+    auto acc_1 = vdupq_n_f32(0.0f);
+    auto acc_2 = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        auto d_a = vsubq_f32(vld1q_f32(a + i), vld1q_f32(a_lag + i));
+        auto d_b = vsubq_f32(vld1q_f32(b + i), vld1q_f32(b_lag + i));
+        acc_1 = vmlaq_f32(acc_1, d_a, d_a);
+        acc_2 = vmlaq_f32(acc_2, d_b, d_b);
+    }
+    auto acc = vsubq_f32(acc_1, acc_2);
+    sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#endif
+
+    for (; i < n; ++i) {
+        auto d_a = a[i] - a_lag[i];
+        auto d_b = b[i] - b_lag[i];
+        sum += d_a * d_a - d_b * d_b;
+    }
+    return sum;
+}
+
+float parabolic_vertex(float a, float b, float c, float* value) {
+    *value = b;
+    auto denominator = a - 2.0f * b + c;
+    if (denominator == 0.0f) {
+        return 0.0f;
+    }
+    auto delta = 0.5f * (a - c) / denominator;
+    *value = b - 0.25f * (a - c) * delta;
+    return delta;
+}
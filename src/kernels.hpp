@@ -0,0 +1,19 @@
+#ifndef kernels_hpp
+#define kernels_hpp
+
+// Inner loops shared by the detectors. The sums are vectorised with SSE or
+// NEON where the target has them, with a scalar tail (or fallback).
+
+// Sum of a[i] * b[i]
+float dot_product(const float* a, const float* b, int n);
+
+// Sum of (a[i] - a_lag[i])^2 - (b[i] - b_lag[i])^2, e.g. the squared
+// differences entering a sliding window minus the ones leaving it
+float sliding_difference(const float* a, const float* a_lag, const float* b, const float* b_lag, int n);
+
+// Fits a parabola through (-1, a), (0, b) and (1, c), where b is a peak or a
+// dip of the three. Returns the offset of the vertex from 0 and sets value
+// to its height, or returns 0 with value = b when the three are flat.
+float parabolic_vertex(float a, float b, float c, float* value);
+
+#endif
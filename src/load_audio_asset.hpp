@@ -1,11 +1,7 @@
 #ifndef AudioAsset_hpp
 #define AudioAsset_hpp
 
-#include "data_types/Area.hpp"
-
-struct AudioAsset {
-    Area left, right;
-};
+#include "load_audio_file.hpp"
 
 AudioAsset load_audio_asset(const char* asset_name);
 
@@ -0,0 +1,42 @@
+#include "load_audio_file.hpp"
+#include "stb_vorbis.c"
+
+inline float convert_sample(short sample) {
+    return (float)((double)sample / 32768.0);
+}
+
+void convert_samples(int num_samples, short* input, float* output) {
+    short* in_ptr     = input;
+    short* in_ptr_end = input + num_samples;
+    float* out_ptr  = output;
+    while (in_ptr < in_ptr_end) {
+        *out_ptr++ = convert_sample(*in_ptr++);
+    }
+}
+
+bool load_audio_file(const char* file_name, AudioAsset* asset) {
+    int num_channels, sample_rate;
+    short* input;
+    auto num_samples = stb_vorbis_decode_filename(file_name, &num_channels, &sample_rate, &input);
+
+    if (num_samples <= 0) {
+        return false;
+    }
+
+    float* output = new float[num_samples * num_channels];
+    convert_samples(num_samples * num_channels, input, output);
+    free(input);
+
+    // Mono files play the same channel on both sides
+    asset->left  = Area(output, num_samples, num_channels);
+    asset->right = Area(output + (num_channels > 1 ? 1 : 0), num_samples, num_channels);
+    asset->sample_rate = sample_rate;
+    asset->num_channels = num_channels;
+    return true;
+}
+
+void destroy_audio_asset(AudioAsset* asset) {
+    delete[] asset->left.ptr;
+    asset->left = Area();
+    asset->right = Area();
+}
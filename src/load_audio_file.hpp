@@ -0,0 +1,15 @@
+#ifndef load_audio_file_hpp
+#define load_audio_file_hpp
+
+#include "data_types/Area.hpp"
+
+struct AudioAsset {
+    Area left, right;
+    int sample_rate;
+    int num_channels;
+};
+
+bool load_audio_file(const char* file_name, AudioAsset* asset);
+void destroy_audio_asset(AudioAsset* asset);
+
+#endif
@@ -4,11 +4,13 @@
 #include <cmath>
 #include <atomic>
 #include <mutex>
+#include <stdlib.h>
 
 #include "audio_client.hpp"
 #include "pitch_detect.hpp"
 #include "peak_image.hpp"
 #include "window_reader.hpp"
+#include "history_recorder.hpp"
 #include "levels.hpp"
 #include "envelope_detect.hpp"
 #include "data_types/ring_buffer.hpp"
@@ -16,11 +18,16 @@
 static PitchDetectState pd_state;
 
 constexpr double WINDOW_TIME = 0.025;
+constexpr double HOP_TIME = 0.005;
 constexpr int SAMPLE_RATE = 44100;
 constexpr int WINDOW_LENGTH = WINDOW_TIME * SAMPLE_RATE;
+constexpr double HISTORY_TIME = 60.0 * 60.0; // 1 hour
 
 static RingBufferState ring_buffer;
 static RingBufferReaderState ring_buffer_reader;
+static WindowReaderState window_reader;
+static HistoryRecorderState history;
+static bool history_enabled;
 
 static float* sample_buffer;
 static int sample_buffer_size;
@@ -157,15 +164,25 @@ void update() {
     }
 }
 
-void window_callback(Area area, long count_) {
+void window_callback(void* user_data, Area area, long count_) {
     std::lock_guard<std::mutex> lg(mutex);
 
+    // Windows overlap, so levels, envelope and sampling only look at the
+    // samples that weren't in the previous window
+    static long fresh_count = 0;
+    if (fresh_count < count_) {
+        fresh_count = count_;
+    }
+    auto fresh = area + (int)(fresh_count - count_);
+    auto fresh_start = fresh_count;
+    fresh_count = count_ + area.num_samples();
+
     Area ac_area, lvl_area;
-    levels_compute(&lvl_state, area, &lvl_area);
+    levels_compute(&lvl_state, fresh, &lvl_area);
     pitch_detect_compute(&pd_state, area, &ac_area, &result);
 
     auto envelope_active_pre = env_state.envelope_active;
-    envelope_detect_compute(&env_state, SAMPLE_RATE, count_, lvl_area, result.confidence);
+    envelope_detect_compute(&env_state, SAMPLE_RATE, fresh_start, lvl_area, result.confidence);
 
     if (!envelope_active_pre && env_state.envelope_active) {
         // Start sampling
@@ -179,14 +196,18 @@ void window_callback(Area area, long count_) {
             }
         }
 
-        if (env_state.time_attack < count_) {
-            // Copy in samples from before the window started (handling lookahead)
+        if (env_state.time_attack < fresh_start) {
+            // Copy in samples from before the new samples started (handling lookahead)
             RingBufferReaderState rbr;
-            rbr = env_state.time_attack;
-            auto in = ring_buffer_read(&ring_buffer, &rbr, (int)(count_ - env_state.time_attack));
-            while (in < in.end) {
-                *sample_buffer_area++ = *in++;
+            ring_buffer_reader_init_at(&rbr, env_state.time_attack, RING_BUFFER_SKIP_TO_OLDEST);
+            ring_buffer_register_reader(&ring_buffer, &rbr);
+            while (rbr.read_point < fresh_start) {
+                auto in = ring_buffer_read(&ring_buffer, &rbr, (int)(fresh_start - rbr.read_point));
+                while (in < in.end) {
+                    *sample_buffer_area++ = *in++;
+                }
             }
+            ring_buffer_unregister_reader(&ring_buffer, &rbr);
         }
     } else if (envelope_active_pre && !env_state.envelope_active) {
         // Stop sampling
@@ -194,11 +215,11 @@ void window_callback(Area area, long count_) {
 
     if (env_state.envelope_active) {
         // Continue sampling
-        auto from = (int)(env_state.time_attack - count_);
+        auto from = (int)(env_state.time_attack - fresh_start);
         if (from < 0) {
             from = 0;
         }
-        auto ptr = area;
+        auto ptr = fresh;
         while (ptr < ptr.end) {
             *sample_buffer_area++ = *ptr++;
         }
@@ -214,12 +235,7 @@ void window_callback(Area area, long count_) {
 }
 
 void read_callback(int num_samples, int num_areas, Area* areas) {
-    auto ptr_in  = areas[0];
-    auto ptr_out = ring_buffer_start_write(&ring_buffer, num_samples);
-    while (ptr_in < ptr_in.end) {
-        *ptr_out++ = *ptr_in++;
-    }
-    ring_buffer_end_write(&ring_buffer, num_samples);
+    ring_buffer_write(&ring_buffer, num_samples, 1, areas);
 }
 
 void write_callback(int num_samples, int num_areas, Area* areas) {
@@ -259,6 +275,11 @@ void write_callback(int num_samples, int num_areas, Area* areas) {
 
 int main(int argc, const char** argv) {
 
+    // Reuse FFTW planner wisdom from previous launches
+    if (auto wisdom_dir = getenv("BMJAP_WISDOM_DIR")) {
+        fft_wisdom_set_cache(wisdom_dir);
+    }
+
     // ddui (graphics and UI system)
     if (!ddui::app_init(700, 600, "BMJ's Audio Programming", update)) {
         printf("Failed to init ddui.\n");
@@ -278,11 +299,24 @@ int main(int argc, const char** argv) {
 
     levels_init(&lvl_state, SAMPLE_RATE, 0.1, WINDOW_LENGTH); // 0.1s = 100ms decay time
 
-    ring_buffer_init(&ring_buffer, SAMPLE_RATE * 4.0);
+    // Other processes can attach to the live input when it's shared
+    auto shared_name = getenv("BMJAP_SHARED_RING");
+    if (!shared_name || !ring_buffer_init_shared(&ring_buffer, shared_name, SAMPLE_RATE * 4.0)) {
+        ring_buffer_init(&ring_buffer, SAMPLE_RATE * 4.0, 1, RING_BUFFER_MIRRORED);
+    }
     ring_buffer_reader_init(&ring_buffer, &ring_buffer_reader);
+    ring_buffer_register_reader(&ring_buffer, &ring_buffer_reader);
 
-    window_reader_init(&ring_buffer, WINDOW_TIME, SAMPLE_RATE, window_callback);
-    window_reader_start();
+    // Keep a long history of the input on disk
+    if (auto history_file = getenv("BMJAP_HISTORY_FILE")) {
+        history_enabled = history_recorder_init(&history, &ring_buffer, history_file, HISTORY_TIME, SAMPLE_RATE);
+        if (history_enabled) {
+            history_recorder_start(&history);
+        }
+    }
+
+    window_reader_init(&window_reader, &ring_buffer, WINDOW_TIME, HOP_TIME, SAMPLE_RATE, window_callback);
+    window_reader_start(&window_reader);
 
     pitch_detect_init_state(&pd_state, WINDOW_TIME, SAMPLE_RATE);
     envelope_detect_init(&env_state);
@@ -295,8 +329,17 @@ int main(int argc, const char** argv) {
 
     ddui::app_run();
 
+    // Stop the audio thread before its reader and the ring buffer go away
+    destroy_audio_client();
+    window_reader_stop(&window_reader);
+    window_reader_destroy(&window_reader);
     pitch_detect_destroy(&pd_state);
     levels_destroy(&lvl_state);
+    if (history_enabled) {
+        history_recorder_stop(&history);
+        history_recorder_destroy(&history);
+    }
+    ring_buffer_unregister_reader(&ring_buffer, &ring_buffer_reader);
     ring_buffer_destroy(&ring_buffer);
 
     return 0;
@@ -0,0 +1,71 @@
+#include "peak_render.hpp"
+
+void render_peaks(unsigned char* data, int width, int height, Area area, const unsigned char fg_bytes[4]) {
+
+    unsigned char bg_bytes[4];
+    bg_bytes[0] = fg_bytes[0];
+    bg_bytes[1] = fg_bytes[1];
+    bg_bytes[2] = fg_bytes[2];
+    bg_bytes[3] = 0x00; // transparent
+
+    // Fill with background
+    for (long i = 0; i < 4 * width * height; i += 4) {
+        data[i  ] = bg_bytes[0];
+        data[i+1] = bg_bytes[1];
+        data[i+2] = bg_bytes[2];
+        data[i+3] = bg_bytes[3];
+    }
+    
+    int num_samples = ((area.end - area.ptr) / area.step);
+
+    // Fill foreground
+    auto ptr = area;
+    float last_sample = *ptr;
+    for (auto x = 0; x < width; ++x) {
+
+        // Get the value
+        int y0, y1;
+        {
+            int i_end = ((double)(x + 1) / (double)width) * num_samples;
+            auto ptr_end = area.ptr + i_end * area.step;
+            if (ptr_end > ptr.end) {
+                ptr_end = ptr.end;
+            }
+            float min_value = last_sample;
+            float max_value = last_sample;
+            for (; ptr < ptr_end; ++ptr) {
+                last_sample = *ptr;
+                if (min_value > last_sample) {
+                    min_value = last_sample;
+                }
+                if (max_value < last_sample) {
+                    max_value = last_sample;
+                }
+            }
+            y0 = height * (1.0 - (max_value + 1.0) * 0.5);
+            y1 = height * (1.0 - (min_value + 1.0) * 0.5);
+        }
+
+        if (y0 < 0) {
+            y0 = 0;
+        }
+        if (y0 >= height) {
+            y0 = height;
+        }
+        if (y1 < 0) {
+            y1 = 0;
+        }
+        if (y1 >= height) {
+            y1 = height;
+        }
+
+        // Fill in the pixels
+        for (auto y = y0; y <= y1; ++y) {
+            auto i = 4 * (width * y + x);
+            data[i  ] = fg_bytes[0];
+            data[i+1] = fg_bytes[1];
+            data[i+2] = fg_bytes[2];
+            data[i+3] = fg_bytes[3];
+        }
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef peak_render_hpp
+#define peak_render_hpp
+
+#include "data_types/Area.hpp"
+
+// Renders the min/max envelope of area into an RGBA image, one column per
+// pixel, on a transparent background
+void render_peaks(unsigned char* data, int width, int height, Area area, const unsigned char fg_bytes[4]);
+
+#endif
@@ -1,29 +1,94 @@
 #include "pitch_detect.hpp"
+#include "kernels.hpp"
 #include <cmath>
 
-void pitch_detect_init_state(PitchDetectState* state, double window_time, int sample_rate) {
+void pitch_detect_init_state(PitchDetectState* state, double window_time, int sample_rate, double min_frequency, double max_frequency, FFTPrecision precision, PitchDetectMethod method, int decimation) {
 
     state->window_time = window_time;
+    state->method = method;
     state->sample_rate = sample_rate;
     state->window_length = (int)(window_time * sample_rate);
 
-    state->fft_state = fft_init(state->window_length);
+    // One lag of margin below the shortest period, so that a pitch right at
+    // max_frequency isn't mistaken for the tail of the first peak
+    state->min_lag = max_frequency > 0.0 ? (int)floor(sample_rate / max_frequency) - 1 : 1;
+    state->max_lag = min_frequency > 0.0 ? (int)ceil(sample_rate / min_frequency) : state->window_length - 1;
+    if (state->min_lag < 1) {
+        state->min_lag = 1;
+    }
+    if (state->max_lag > state->window_length - 1) {
+        state->max_lag = state->window_length - 1;
+    }
+
+    // The decimated lags cover the full rate range, with a lag of margin
+    // on either side for the refinement
+    state->decimation = decimation;
+    decimate_init(&state->decimate_state, decimation, state->window_length);
+    auto analysis_length = state->window_length / decimation;
+    auto analysis_min_lag = decimation > 1 ? state->min_lag / decimation - 1 : state->min_lag;
+    auto analysis_max_lag = decimation > 1 ? state->max_lag / decimation + 1 : state->max_lag;
+    state->window = decimation > 1 ? new float[state->window_length] : nullptr;
 
-    state->data = new float[state->window_length];
+    autocorrelation_init(&state->ac_state, analysis_length, analysis_min_lag, analysis_max_lag, precision);
+
+    state->data = new float[analysis_length];
 }
 
-void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_out, PitchDetectResult* result) {
-    *window_out = Area(state->data, window_in.num_samples(), 1);
-    fft_compute(state->fft_state, window_in, *window_out);
+// Turns the normalised autocorrelation of in (lags up to max_lag) into the
+// NSDF: n(t) = 2 r(t) / m(t), where m(t) is the energy of the two
+// overlapping parts, m(t) = sum over j < W - t of x[j]^2 + x[j + t]^2
+static void autocorrelation_to_nsdf(Area in, Area acf, int max_lag) {
+    auto x = in.ptr;
+    auto step = in.step;
+    auto window_length = in.num_samples();
 
-    auto ptr = *window_out;
+    double energy = 0.0;
+    for (int j = 0; j < window_length; ++j) {
+        energy += (double)x[j * step] * x[j * step];
+    }
+
+    // The autocorrelation was divided by r(0) = energy
+    auto m = 2.0 * energy;
+    acf.ptr[0] = energy > 0.0 ? 1.0f : 0.0f;
+    for (int t = 1; t <= max_lag; ++t) {
+        auto a = x[(t - 1) * step];
+        auto b = x[(window_length - t) * step];
+        m -= (double)a * a + (double)b * b;
+        acf.ptr[t] = m > 0.0 ? (float)(2.0 * energy * acf.ptr[t] / m) : 0.0f;
+    }
+    for (auto ptr = acf + (max_lag + 1); ptr < ptr.end; ++ptr) {
+        *ptr = 0.0f;
+    }
+}
+
+// Fits a parabola through the peak at i and its neighbours, returns the
+// offset of its vertex from i and its height
+static float interpolate_peak(const float* data, int i, int min_i, int max_i, float* peak) {
+    *peak = data[i];
+    if (i <= min_i || i >= max_i) {
+        return 0.0f;
+    }
+    return parabolic_vertex(data[i - 1], data[i], data[i + 1], peak);
+}
+
+static void compute_autocorrelation(PitchDetectState* state, Area* window_out, PitchDetectResult* result) {
+
+    // Only search the lags of the requested pitch range
+    auto ptr = *window_out + state->ac_state.min_lag;
+    auto ptr_end = window_out->ptr + state->ac_state.max_lag + 1;
+    if (ptr.end > ptr_end) {
+        ptr.end = ptr_end;
+    }
     
-    // Skip first peak until we cross below zero
-    for (; ptr < ptr.end && *ptr > 0.0; ++ptr) {}
+    // Skip first peak until we cross below zero (when the range starts
+    // past the first peak we're already climbing towards the next one)
+    if (ptr + 1 < ptr.end && *(ptr + 1) < *ptr) {
+        for (; ptr < ptr.end && *ptr > 0.0; ++ptr) {}
+    }
 
     // Find max value
     int max_i = 0;
-    auto max = *ptr;
+    float max = 0.0;
     for (; ptr < ptr.end; ++ptr) {
         if (max < *ptr) {
             max = *ptr;
@@ -31,8 +96,166 @@ void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_
         }
     }
 
-    if (max_i == 0) {
+    pitch_detect_set_result(result, (float)max_i, state->sample_rate / state->decimation, max);
+}
+
+static void compute_mpm(PitchDetectState* state, Area window_in, Area* window_out, PitchDetectResult* result) {
+    auto min_lag = state->ac_state.min_lag;
+    auto max_lag = state->ac_state.max_lag < window_out->num_samples() - 1 ? state->ac_state.max_lag : window_out->num_samples() - 1;
+    autocorrelation_to_nsdf(window_in, *window_out, max_lag);
+    auto nsdf = window_out->ptr;
+
+    // Skip the first lobe, as above
+    auto i = min_lag;
+    if (i + 1 <= max_lag && nsdf[i + 1] < nsdf[i]) {
+        for (; i <= max_lag && nsdf[i] > 0.0f; ++i) {}
+    }
+
+    // Key maxima: the highest point of every positive lobe
+    constexpr int MAX_KEY_MAXIMA = 64;
+    int key_maxima[MAX_KEY_MAXIMA];
+    int num_key_maxima = 0;
+    float highest = 0.0f;
+    while (i <= max_lag && num_key_maxima < MAX_KEY_MAXIMA) {
+        for (; i <= max_lag && nsdf[i] <= 0.0f; ++i) {}
+        if (i > max_lag) {
+            break;
+        }
+        auto best = i;
+        for (; i <= max_lag && nsdf[i] > 0.0f; ++i) {
+            if (nsdf[i] > nsdf[best]) {
+                best = i;
+            }
+        }
+
+        // A lobe still rising at the end of the range has no peak yet
+        if (best == max_lag) {
+            break;
+        }
+        key_maxima[num_key_maxima++] = best;
+        if (nsdf[best] > highest) {
+            highest = nsdf[best];
+        }
+    }
+
+    // The first key maximum close enough to the highest is the period, the
+    // later ones are its multiples
+    for (int k = 0; k < num_key_maxima; ++k) {
+        if (nsdf[key_maxima[k]] >= MPM_THRESHOLD * highest) {
+            float peak;
+            auto delta = interpolate_peak(nsdf, key_maxima[k], min_lag, max_lag, &peak);
+            pitch_detect_set_result(result, key_maxima[k] + delta, state->sample_rate / state->decimation, peak > 1.0f ? 1.0f : peak);
+            return;
+        }
+    }
+
+    pitch_detect_set_result(result, 0.0f, state->sample_rate, 0.0f);
+}
+
+// Looks for the real peak among the full rate lags within one decimated
+// lag of centre, with a dot product per lag. Returns false if there are no
+// lags to search.
+static bool refine_lag(PitchDetectState* state, const float* x, int n, float energy, int centre, float* period, float* value) {
+    auto decimation = state->decimation;
+    auto lo = centre - decimation > state->min_lag ? centre - decimation : state->min_lag;
+    auto hi = centre + decimation < state->max_lag ? centre + decimation : state->max_lag;
+    auto first = lo - 1 > 1 ? lo - 1 : 1;
+    auto last = hi + 1 < n - 1 ? hi + 1 : n - 1;
+    if (lo > hi || first > last) {
+        return false;
+    }
+
+    // ... the autocorrelation, or the NSDF for MPM, of lags first...last
+    float values[2 * DECIMATE_MAX_FACTOR + 3];
+    {
+        double m = 2.0 * energy;
+        for (int j = 0; j < first - 1; ++j) {
+            m -= (double)x[j] * x[j] + (double)x[n - 1 - j] * x[n - 1 - j];
+        }
+        for (int t = first; t <= last; ++t) {
+            m -= (double)x[t - 1] * x[t - 1] + (double)x[n - t] * x[n - t];
+            auto r = autocorrelation_lag(x, n, t);
+            if (state->method == PITCH_DETECT_MPM) {
+                values[t - first] = m > 0.0 ? (float)(2.0 * r / m) : 0.0f;
+            } else {
+                values[t - first] = r / energy;
+            }
+        }
+    }
+
+    auto best = lo - first;
+    for (int i = lo - first; i <= hi - first; ++i) {
+        if (values[i] > values[best]) {
+            best = i;
+        }
+    }
+
+    // Only interpolate a real peak, not the edge of the search
+    auto is_peak = best > 0 && best < last - first && values[best - 1] <= values[best] && values[best + 1] <= values[best];
+    if (state->method == PITCH_DETECT_MPM && is_peak) {
+        auto delta = interpolate_peak(values, best, 0, last - first, value);
+        *period = first + best + delta;
+    } else {
+        *period = (float)(first + best);
+        *value = values[best];
+    }
+    return true;
+}
+
+static void refine_period(PitchDetectState* state, Area window_in, PitchDetectResult* result) {
+    auto n = window_in.num_samples();
+
+    const float* x = window_in.ptr;
+    if (window_in.step != 1) {
+        Area::copy_over(window_in, Area(state->window, state->window_length, 1));
+        x = state->window;
+    }
+
+    auto energy = autocorrelation_lag(x, n, 0);
+    auto centre = (int)round(result->period * state->decimation);
+    float period, value;
+    if (energy <= 0.0f || !refine_lag(state, x, n, energy, centre, &period, &value)) {
+        pitch_detect_set_result(result, 0.0f, state->sample_rate, 0.0f);
+        return;
+    }
+
+    // Short periods only span a few decimated lags, so their peaks can come
+    // out lower than the one at twice the period. Check half the period too,
+    // picking between the two as the method does at the full rate: MPM
+    // within MPM_THRESHOLD of the higher one, ACF only if it's higher.
+    auto threshold = state->method == PITCH_DETECT_MPM ? MPM_THRESHOLD : 1.0f;
+    float half_period, half_value;
+    if (refine_lag(state, x, n, energy, centre / 2, &half_period, &half_value) && half_value >= threshold * value) {
+        period = half_period;
+        value = half_value;
+    }
+
+    pitch_detect_set_result(result, period, state->sample_rate, value > 1.0f ? 1.0f : value);
+}
+
+void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_out, PitchDetectResult* result) {
+    Area analysis_in;
+    decimate_compute(&state->decimate_state, window_in, &analysis_in);
+
+    *window_out = Area(state->data, analysis_in.num_samples(), 1);
+    autocorrelation_compute(&state->ac_state, analysis_in, *window_out);
+
+    if (state->method == PITCH_DETECT_MPM) {
+        compute_mpm(state, analysis_in, window_out, result);
+    } else {
+        compute_autocorrelation(state, window_out, result);
+    }
+
+    if (state->decimation > 1 && result->period > 0.0f) {
+        refine_period(state, window_in, result);
+    }
+}
+
+void pitch_detect_set_result(PitchDetectResult* result, float period, int sample_rate, float confidence) {
+
+    if (period <= 0.0f) {
         result->wave_length = 0;
+        result->period = 0.0f;
         result->confidence = 0;
         result->frequency = 0.0;
         result->note_name = "";
@@ -41,7 +264,7 @@ void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_
         return;
     }
 
-    auto frequency = state->sample_rate / max_i;
+    auto frequency = (float)sample_rate / period;
 
     constexpr const char* NOTE_NAMES[12] = {
         "A", "A#", "B", "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#"
@@ -52,12 +275,16 @@ void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_
     auto note_value = 12.0 * log(frequency / FREQ_A0) / log(2.0);
     auto note_value_fixed = (int)round(note_value);
     auto note_value_cents = (int)round((note_value - note_value_fixed) * 100);
-    auto note_value_octave = note_value_fixed / 12;
-    auto note = NOTE_NAMES[note_value_fixed % 12];
+
+    // Below A0 the note value is negative, so wrap it rather than truncate
+    auto note_index = ((note_value_fixed % 12) + 12) % 12;
+    auto note_value_octave = (note_value_fixed - note_index) / 12;
+    auto note = NOTE_NAMES[note_index];
 
     // Fill result
-    result->wave_length = max_i;
-    result->confidence = max;
+    result->wave_length = (int)round(period);
+    result->period = period;
+    result->confidence = confidence;
     result->frequency = frequency;
     result->note_name = note;
     result->note_octave = (char)note_value_octave;
@@ -65,6 +292,8 @@ void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_
 }
 
 void pitch_detect_destroy(PitchDetectState* state) {
-    fft_destroy(state->fft_state);
+    decimate_destroy(&state->decimate_state);
+    delete[] state->window;
+    autocorrelation_destroy(&state->ac_state);
     delete[] state->data;
 }
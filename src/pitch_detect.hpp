@@ -1,10 +1,23 @@
 #ifndef pitch_detect_hpp
 #define pitch_detect_hpp
 
-#include "fft.hpp"
+#include "autocorrelation.hpp"
+#include "decimate.hpp"
+
+// AUTOCORRELATION takes the highest autocorrelation peak past the first
+// lobe, to the nearest whole lag. MPM (McLeod's pitch method) normalises it
+// into the NSDF, takes the first peak within MPM_THRESHOLD of the highest
+// one and interpolates it, so the period has sub-sample accuracy.
+enum PitchDetectMethod {
+    PITCH_DETECT_AUTOCORRELATION,
+    PITCH_DETECT_MPM
+};
+
+constexpr float MPM_THRESHOLD = 0.9f;
 
 struct PitchDetectResult {
     int wave_length;
+    float period; // in samples, fractional with MPM
     float confidence;
     float frequency;
     const char* note_name;
@@ -16,13 +29,35 @@ struct PitchDetectState {
     double window_time;
     int sample_rate;
     int window_length;
+    int min_lag;
+    int max_lag;
+    PitchDetectMethod method;
 
-    FFTState* fft_state;
+    // The autocorrelation runs at sample_rate / decimation, then the lags
+    // around its peak are refined at the full rate
+    int decimation;
+    DecimateState decimate_state;
+    float* window; // the full rate window, when it isn't contiguous
+
+    AutocorrelationState ac_state;
     float* data;
 };
 
-void pitch_detect_init_state(PitchDetectState* state, double window_time, int sample_rate);
+// min_frequency and max_frequency limit the pitch range searched (0 for no
+// limit), which lets the autocorrelation skip the lags outside it.
+// decimation (1, 2, 4 or 8) runs the autocorrelation at a lower rate, for
+// inputs like voice or bass where nothing above a few kHz matters for
+// pitch. max_frequency should stay under about 0.4 * sample_rate /
+// decimation.
+void pitch_detect_init_state(PitchDetectState* state, double window_time, int sample_rate, double min_frequency = 0.0, double max_frequency = 0.0, FFTPrecision precision = FFT_PRECISION_FLOAT, PitchDetectMethod method = PITCH_DETECT_AUTOCORRELATION, int decimation = 1);
+
+// window_out is the autocorrelation (AUTOCORRELATION) or the NSDF (MPM),
+// one value per lag at sample_rate / decimation
 void pitch_detect_compute(PitchDetectState* state, Area window_in, Area* window_out, PitchDetectResult* result);
+
+// Fills in the frequency and note of a period (in samples), or an empty
+// result for a period of 0
+void pitch_detect_set_result(PitchDetectResult* result, float period, int sample_rate, float confidence);
 void pitch_detect_destroy(PitchDetectState* state);
 
 #endif
@@ -0,0 +1,287 @@
+#include "pitch_track.hpp"
+#include "kernels.hpp"
+#include <assert.h>
+#include <cmath>
+#include <stdlib.h>
+
+// Thresholds are spread by a beta(2, 18) distribution (mean 0.1, YIN's
+// usual threshold). When no dip is under a threshold its weight goes to
+// the lowest dip, scaled down by NO_DIP_WEIGHT.
+constexpr double THRESHOLD_ALPHA = 2.0;
+constexpr double THRESHOLD_BETA = 18.0;
+constexpr float NO_DIP_WEIGHT = 0.01f;
+
+// How far the candidate probabilities are trusted over "unvoiced"
+constexpr float YIN_TRUST = 0.5f;
+
+// Largest pitch step between consecutive windows, and the probability of
+// switching between voiced and unvoiced
+constexpr double MAX_JUMP_CENTS = 240.0;
+constexpr float VOICING_SWITCH = 0.01f;
+
+constexpr float MIN_PROBABILITY = 1e-9f;
+
+void pitch_track_init(PitchTrackState* state, double window_time, int sample_rate, double min_frequency, double max_frequency, int lookahead) {
+    assert(min_frequency > 0.0 && max_frequency > min_frequency);
+
+    yin_pitch_init(&state->yin_state, window_time, sample_rate, min_frequency, max_frequency);
+
+    state->sample_rate = sample_rate;
+    state->min_frequency = min_frequency;
+    state->num_bins = (int)(1200.0 * log2(max_frequency / min_frequency) / PITCH_TRACK_BIN_CENTS) + 1;
+    state->num_states = 2 * state->num_bins;
+    state->lookahead = lookahead;
+
+    // ... threshold distribution
+    {
+        double sum = 0.0;
+        for (int i = 0; i < PITCH_TRACK_NUM_THRESHOLDS; ++i) {
+            auto s = (i + 1.0) / PITCH_TRACK_NUM_THRESHOLDS;
+            auto w = pow(s, THRESHOLD_ALPHA - 1.0) * pow(1.0 - s, THRESHOLD_BETA - 1.0);
+            state->threshold_weights[i] = (float)w;
+            sum += w;
+        }
+        for (int i = 0; i < PITCH_TRACK_NUM_THRESHOLDS; ++i) {
+            state->threshold_weights[i] /= (float)sum;
+        }
+    }
+
+    // ... triangular pitch transitions
+    {
+        state->max_jump = (int)(MAX_JUMP_CENTS / PITCH_TRACK_BIN_CENTS);
+        state->log_transitions = new float[state->max_jump + 1];
+        double sum = 0.0;
+        for (int j = -state->max_jump; j <= state->max_jump; ++j) {
+            sum += state->max_jump + 1 - abs(j);
+        }
+        for (int j = 0; j <= state->max_jump; ++j) {
+            state->log_transitions[j] = (float)log((state->max_jump + 1 - j) / sum);
+        }
+    }
+
+    state->dips = new int[state->yin_state.max_lag];
+    state->dip_probabilities = new float[state->yin_state.max_lag];
+    state->log_observations = new float[state->num_states];
+    state->scores = new float[state->num_states];
+    state->next_scores = new float[state->num_states];
+    state->frames = new PitchTrackFrame[lookahead + 1];
+    state->backpointers = new short[(lookahead + 1) * state->num_states];
+    state->num_frames = 0;
+}
+
+// The dips of d' and how likely each is the period
+static void find_candidates(PitchTrackState* state, const float* cmndf, PitchTrackFrame* frame) {
+    auto yin = &state->yin_state;
+    frame->num_candidates = 0;
+
+    // ... every local minimum in the lag range, in order of lag
+    auto dips = state->dips;
+    auto probabilities = state->dip_probabilities;
+    int num_dips = 0;
+    int lowest = -1;
+    for (int t = yin->min_lag + 1; t < yin->max_lag; ++t) {
+        if (cmndf[t] < cmndf[t - 1] && cmndf[t] <= cmndf[t + 1] && cmndf[t] < 1.0f) {
+            if (lowest < 0 || cmndf[t] < cmndf[dips[lowest]]) {
+                lowest = num_dips;
+            }
+            probabilities[num_dips] = 0.0f;
+            dips[num_dips++] = t;
+        }
+    }
+    if (num_dips == 0) {
+        return;
+    }
+
+    // ... each threshold votes for the first dip under it
+    for (int i = 0; i < PITCH_TRACK_NUM_THRESHOLDS; ++i) {
+        auto threshold = (i + 1.0f) / PITCH_TRACK_NUM_THRESHOLDS;
+        int d = 0;
+        while (d < num_dips && cmndf[dips[d]] >= threshold) {
+            ++d;
+        }
+        if (d < num_dips) {
+            probabilities[d] += state->threshold_weights[i];
+        } else {
+            probabilities[lowest] += state->threshold_weights[i] * NO_DIP_WEIGHT;
+        }
+    }
+
+    // ... keep the most likely ones
+    while (frame->num_candidates < PITCH_TRACK_CANDIDATES) {
+        int d = -1;
+        for (int i = 0; i < num_dips; ++i) {
+            if (probabilities[i] > 0.0f && (d < 0 || probabilities[i] > probabilities[d])) {
+                d = i;
+            }
+        }
+        if (d < 0) {
+            break;
+        }
+        auto probability = probabilities[d];
+        probabilities[d] = 0.0f;
+
+        // ... interpolate the period
+        auto t = dips[d];
+        float value;
+        auto period = t + parabolic_vertex(cmndf[t - 1], cmndf[t], cmndf[t + 1], &value);
+
+        auto frequency = state->sample_rate / period;
+        auto bin = (int)floor(1200.0 * log2(frequency / state->min_frequency) / PITCH_TRACK_BIN_CENTS + 0.5);
+        if (bin < 0 || bin >= state->num_bins) {
+            continue;
+        }
+
+        auto candidate = &frame->candidates[frame->num_candidates++];
+        candidate->period = period;
+        candidate->probability = probability;
+        candidate->bin = bin;
+    }
+}
+
+static void compute_observations(PitchTrackState* state, const PitchTrackFrame* frame) {
+    auto num_bins = state->num_bins;
+    auto observations = state->log_observations;
+
+    float voiced_probability = 0.0f;
+    for (int i = 0; i < frame->num_candidates; ++i) {
+        voiced_probability += frame->candidates[i].probability;
+    }
+
+    auto unvoiced = (1.0f - YIN_TRUST * voiced_probability) / num_bins;
+    for (int b = 0; b < num_bins; ++b) {
+        observations[b] = unvoiced;
+        observations[num_bins + b] = 0.0f;
+    }
+    for (int i = 0; i < frame->num_candidates; ++i) {
+        observations[num_bins + frame->candidates[i].bin] += YIN_TRUST * frame->candidates[i].probability;
+    }
+    for (int s = 0; s < state->num_states; ++s) {
+        observations[s] = logf(observations[s] > MIN_PROBABILITY ? observations[s] : MIN_PROBABILITY);
+    }
+}
+
+// One Viterbi step: for every state the best predecessor within max_jump
+// bins, voiced or not
+static void viterbi_step(PitchTrackState* state, short* backpointers) {
+    auto num_bins = state->num_bins;
+    auto max_jump = state->max_jump;
+    auto scores = state->scores;
+    auto next_scores = state->next_scores;
+    auto log_stay = logf(1.0f - VOICING_SWITCH);
+    auto log_switch = logf(VOICING_SWITCH);
+
+    auto best_score = -INFINITY;
+    for (int s = 0; s < state->num_states; ++s) {
+        auto voiced = s >= num_bins;
+        auto b = voiced ? s - num_bins : s;
+        auto lo = b - max_jump < 0 ? 0 : b - max_jump;
+        auto hi = b + max_jump > num_bins - 1 ? num_bins - 1 : b + max_jump;
+
+        auto best = -INFINITY;
+        int best_source = s;
+        for (int v = 0; v < 2; ++v) {
+            auto log_voicing = (v == 1) == voiced ? log_stay : log_switch;
+            auto source_scores = scores + v * num_bins;
+            for (int source = lo; source <= hi; ++source) {
+                auto score = source_scores[source] + state->log_transitions[abs(source - b)] + log_voicing;
+                if (score > best) {
+                    best = score;
+                    best_source = v * num_bins + source;
+                }
+            }
+        }
+
+        next_scores[s] = best + state->log_observations[s];
+        backpointers[s] = (short)best_source;
+        if (next_scores[s] > best_score) {
+            best_score = next_scores[s];
+        }
+    }
+
+    // Keep the scores near 0
+    for (int s = 0; s < state->num_states; ++s) {
+        scores[s] = next_scores[s] - best_score;
+    }
+}
+
+static void set_result(PitchTrackState* state, int s, const PitchTrackFrame* frame, PitchTrackResult* result) {
+    auto num_bins = state->num_bins;
+    result->start_count = frame->start_count;
+    result->voiced = s >= num_bins;
+    if (!result->voiced) {
+        pitch_detect_set_result(&result->pitch, 0.0f, state->sample_rate, 0.0f);
+        return;
+    }
+
+    // The candidate in the state's bin, or its centre if there's none
+    auto b = s - num_bins;
+    const PitchTrackCandidate* best = NULL;
+    for (int i = 0; i < frame->num_candidates; ++i) {
+        auto candidate = &frame->candidates[i];
+        if (candidate->bin == b && (!best || candidate->probability > best->probability)) {
+            best = candidate;
+        }
+    }
+    if (best) {
+        pitch_detect_set_result(&result->pitch, best->period, state->sample_rate, best->probability);
+    } else {
+        auto frequency = state->min_frequency * exp2(b * PITCH_TRACK_BIN_CENTS / 1200.0);
+        pitch_detect_set_result(&result->pitch, (float)(state->sample_rate / frequency), state->sample_rate, 0.0f);
+    }
+}
+
+bool pitch_track_compute(PitchTrackState* state, Area window_in, long start_count, PitchTrackResult* result) {
+    auto num_slots = state->lookahead + 1;
+    auto slot = (int)(state->num_frames % num_slots);
+    auto frame = &state->frames[slot];
+    auto backpointers = state->backpointers + slot * state->num_states;
+
+    // ... candidates from YIN's d'
+    Area cmndf;
+    PitchDetectResult yin_result;
+    yin_pitch_detect(&state->yin_state, window_in, start_count, &cmndf, &yin_result);
+    frame->start_count = start_count;
+    find_candidates(state, cmndf.ptr, frame);
+    compute_observations(state, frame);
+
+    // ... decode
+    if (state->num_frames == 0) {
+        for (int s = 0; s < state->num_states; ++s) {
+            state->scores[s] = state->log_observations[s];
+            backpointers[s] = (short)s;
+        }
+    } else {
+        viterbi_step(state, backpointers);
+    }
+    ++state->num_frames;
+
+    if (state->num_frames <= state->lookahead) {
+        return false;
+    }
+
+    // ... and trace the best path back lookahead windows
+    int s = 0;
+    for (int i = 1; i < state->num_states; ++i) {
+        if (state->scores[i] > state->scores[s]) {
+            s = i;
+        }
+    }
+    for (int i = 0; i < state->lookahead; ++i) {
+        s = state->backpointers[((slot - i + num_slots) % num_slots) * state->num_states + s];
+    }
+
+    set_result(state, s, &state->frames[(slot + 1) % num_slots], result);
+    return true;
+}
+
+void pitch_track_destroy(PitchTrackState* state) {
+    yin_pitch_destroy(&state->yin_state);
+    delete[] state->dips;
+    delete[] state->dip_probabilities;
+    delete[] state->log_transitions;
+    delete[] state->log_observations;
+    delete[] state->scores;
+    delete[] state->next_scores;
+    delete[] state->frames;
+    delete[] state->backpointers;
+}
@@ -0,0 +1,72 @@
+#ifndef pitch_track_hpp
+#define pitch_track_hpp
+
+#include "yin_pitch.hpp"
+
+// Streaming pitch tracking in the style of pYIN. Every window gives several
+// candidates (the dips of YIN's d'), weighted by how many thresholds of a
+// beta distribution would pick them. A hidden Markov model over
+// PITCH_TRACK_BIN_CENTS pitch bins, each voiced or unvoiced, then favours
+// small pitch steps and rare voicing changes. The Viterbi path is decoded
+// with a fixed lookahead, so the decision for a window comes out lookahead
+// windows later, and every table is allocated in pitch_track_init.
+
+constexpr int PITCH_TRACK_CANDIDATES = 8;
+constexpr int PITCH_TRACK_LOOKAHEAD = 8;
+constexpr double PITCH_TRACK_BIN_CENTS = 20.0;
+constexpr int PITCH_TRACK_NUM_THRESHOLDS = 100;
+
+struct PitchTrackCandidate {
+    float period;
+    float probability;
+    int bin;
+};
+
+struct PitchTrackFrame {
+    long start_count;
+    int num_candidates;
+    PitchTrackCandidate candidates[PITCH_TRACK_CANDIDATES];
+};
+
+struct PitchTrackResult {
+    long start_count; // of the window decided on
+    bool voiced;
+    PitchDetectResult pitch; // empty if unvoiced
+};
+
+struct PitchTrackState {
+    YinPitchState yin_state;
+    int sample_rate;
+    double min_frequency;
+    int num_bins;
+    int num_states; // num_bins unvoiced, then num_bins voiced
+    int lookahead;
+
+    float threshold_weights[PITCH_TRACK_NUM_THRESHOLDS];
+    int* dips; // local minima of d', up to max_lag
+    float* dip_probabilities;
+
+    int max_jump;           // in bins per window
+    float* log_transitions; // by pitch step, 0...max_jump
+    float* log_observations;
+    float* scores;
+    float* next_scores;
+
+    // Frame i is kept in slot i % (lookahead + 1) along with the best
+    // predecessor of each of its states
+    PitchTrackFrame* frames;
+    short* backpointers;
+    long num_frames;
+};
+
+// The pitch bins span min_frequency...max_frequency, so both are needed:
+// 0 < min_frequency < max_frequency is asserted.
+void pitch_track_init(PitchTrackState* state, double window_time, int sample_rate, double min_frequency = 60.0, double max_frequency = 1000.0, int lookahead = PITCH_TRACK_LOOKAHEAD);
+
+// Takes the next window (starting at start_count, see yin_pitch_detect).
+// Returns true with the decision for the window lookahead windows back
+// once that many have been seen.
+bool pitch_track_compute(PitchTrackState* state, Area window_in, long start_count, PitchTrackResult* result);
+void pitch_track_destroy(PitchTrackState* state);
+
+#endif
@@ -0,0 +1,221 @@
+#include "poly_pitch.hpp"
+#include "kernels.hpp"
+#include <assert.h>
+#include <cmath>
+
+// Stop once the best candidate is this far below the first pitch found
+constexpr float RELATIVE_SALIENCE = 0.2f;
+constexpr float MIN_SALIENCE = 1e-3f;
+
+// Partials are searched for this far (relative) around h * f0, which
+// allows for the stretched partials of strings
+constexpr float PARTIAL_TOLERANCE = 0.015f;
+
+// Candidates this close (in grid steps) to a pitch already found are skipped
+constexpr int MIN_SEPARATION = 5;
+
+void poly_pitch_init(PolyPitchState* state, double window_time, int sample_rate, double min_frequency, double max_frequency, int max_pitches, FFTPrecision precision) {
+    assert(min_frequency > 0.0 && max_frequency > min_frequency);
+
+    state->window_time = window_time;
+    state->sample_rate = sample_rate;
+    state->window_length = (int)(window_time * sample_rate);
+    state->max_pitches = max_pitches < POLY_PITCH_MAX_PITCHES ? max_pitches : POLY_PITCH_MAX_PITCHES;
+
+    auto N = fft_transform_size(state->window_length);
+    state->num_bins = N / 2 + 1;
+    state->bin_frequency = (double)sample_rate / N;
+
+    // A Hann main lobe is 2 unpadded bins either side of the peak
+    state->partial_width = (int)ceil(2.0 * N / state->window_length);
+
+    state->fft_state = fft_init(state->window_length, precision);
+    state->spectrum = new float[state->num_bins];
+    state->residual = new float[state->num_bins];
+
+    state->num_candidates = (int)(1200.0 * log2(max_frequency / min_frequency) / POLY_PITCH_RESOLUTION) + 1;
+    state->candidate_bins = new float[state->num_candidates];
+    state->salience = new float[state->num_candidates];
+    for (int c = 0; c < state->num_candidates; ++c) {
+        auto frequency = min_frequency * exp2(c * POLY_PITCH_RESOLUTION / 1200.0);
+        state->candidate_bins[c] = (float)(frequency / state->bin_frequency);
+    }
+}
+
+// The bin of the spectral peak near bin position b, or -1 if there is only
+// the slope of a neighbouring peak
+static int find_partial(const float* spectrum, int num_bins, float b) {
+    auto tolerance = 1 + (int)(b * PARTIAL_TOLERANCE);
+    auto lo = (int)(b + 0.5f) - tolerance;
+    auto hi = (int)(b + 0.5f) + tolerance;
+    if (lo < 1) {
+        lo = 1;
+    }
+    if (hi > num_bins - 2) {
+        hi = num_bins - 2;
+    }
+    if (lo > hi) {
+        return -1;
+    }
+
+    auto best = lo;
+    for (int k = lo + 1; k <= hi; ++k) {
+        if (spectrum[k] > spectrum[best]) {
+            best = k;
+        }
+    }
+    if (spectrum[best - 1] > spectrum[best] || spectrum[best + 1] > spectrum[best]) {
+        return -1;
+    }
+    return best;
+}
+
+// Weighted sum of the partials of f0 (in bins). The weights fall off as
+// 1 / h, so f0 outscores its subharmonics, which only collect every other
+// partial at half the weight.
+static float harmonic_sum(const float* spectrum, int num_bins, float f0) {
+    float sum = 0.0f;
+    for (int h = 1; h <= POLY_PITCH_HARMONICS && h * f0 < num_bins - 2; ++h) {
+        auto k = find_partial(spectrum, num_bins, h * f0);
+        if (k >= 0) {
+            sum += spectrum[k] / h;
+        }
+    }
+    return sum;
+}
+
+// Removes the partials of f0 from the residual. A partial standing well
+// above both of its neighbours is probably shared with another note, so
+// it's only brought down to their level. Returns the estimated f0 from the
+// interpolated partial positions and the energy removed.
+static float cancel_partials(PolyPitchState* state, float f0, float* energy) {
+    auto residual = state->residual;
+    auto num_bins = state->num_bins;
+
+    int bins[POLY_PITCH_HARMONICS + 2];
+    float amplitudes[POLY_PITCH_HARMONICS + 2];
+    int num_harmonics = 0;
+    for (int h = 1; h <= POLY_PITCH_HARMONICS && h * f0 < num_bins - 2; ++h) {
+        auto k = find_partial(residual, num_bins, h * f0);
+        bins[h] = k;
+        amplitudes[h] = k >= 0 ? residual[k] : 0.0f;
+        num_harmonics = h;
+    }
+    amplitudes[num_harmonics + 1] = 0.0f;
+
+    double f0_sum = 0.0;
+    double weight_sum = 0.0;
+    *energy = 0.0f;
+    for (int h = 1; h <= num_harmonics; ++h) {
+        auto k = bins[h];
+        auto a = amplitudes[h];
+        if (k < 0 || a <= 0.0f) {
+            continue;
+        }
+
+        // ... refine the partial's position on the original spectrum (the
+        // lower partials count for more, the higher ones are stretched)
+        {
+            // (k may sit on the shoulder of a peak there, which still
+            // counts as long as the parabola opens downwards)
+            auto spectrum = state->spectrum;
+            float peak;
+            auto delta = parabolic_vertex(spectrum[k - 1], spectrum[k], spectrum[k + 1], &peak);
+            if (peak < spectrum[k]) {
+                delta = 0.0f;
+            }
+            f0_sum += a / h * (k + delta) / h;
+            weight_sum += a / h;
+        }
+
+        // ... and cancel it
+        auto cancel = a;
+        if (h > 1) {
+            auto neighbour = amplitudes[h - 1] > amplitudes[h + 1] ? amplitudes[h - 1] : amplitudes[h + 1];
+            if (cancel > neighbour) {
+                cancel = neighbour;
+            }
+        }
+        auto ratio = (a - cancel) / a;
+        auto lo = k - state->partial_width < 0 ? 0 : k - state->partial_width;
+        auto hi = k + state->partial_width > num_bins - 1 ? num_bins - 1 : k + state->partial_width;
+        for (int j = lo; j <= hi; ++j) {
+            auto removed = residual[j] * (1.0f - ratio);
+            residual[j] -= removed;
+            *energy += removed * removed;
+        }
+    }
+
+    return weight_sum > 0.0 ? (float)(f0_sum / weight_sum) : f0;
+}
+
+void poly_pitch_compute(PolyPitchState* state, Area window_in, Area* spectrum_out, PolyPitchResult* result) {
+    auto num_bins = state->num_bins;
+    auto spectrum = state->spectrum;
+    auto residual = state->residual;
+
+    fft_spectrum(state->fft_state, window_in, Area(spectrum, num_bins, 1));
+    *spectrum_out = Area(spectrum, num_bins, 1);
+    for (int k = 0; k < num_bins; ++k) {
+        residual[k] = spectrum[k];
+    }
+
+    int found[POLY_PITCH_MAX_PITCHES];
+    float frequencies[POLY_PITCH_MAX_PITCHES];
+    float energies[POLY_PITCH_MAX_PITCHES];
+    float first_salience = 0.0f;
+    int num_pitches = 0;
+
+    while (num_pitches < state->max_pitches) {
+
+        // ... score every candidate against what's left of the spectrum
+        int best = -1;
+        for (int c = 0; c < state->num_candidates; ++c) {
+            bool taken = false;
+            for (int i = 0; i < num_pitches; ++i) {
+                if (c > found[i] - MIN_SEPARATION && c < found[i] + MIN_SEPARATION) {
+                    taken = true;
+                }
+            }
+            state->salience[c] = taken ? 0.0f : harmonic_sum(residual, num_bins, state->candidate_bins[c]);
+            if (best < 0 || state->salience[c] > state->salience[best]) {
+                best = c;
+            }
+        }
+
+        auto salience = state->salience[best];
+        if (salience < MIN_SALIENCE || salience < RELATIVE_SALIENCE * first_salience) {
+            break;
+        }
+        if (num_pitches == 0) {
+            first_salience = salience;
+        }
+
+        // ... take it out of the spectrum
+        auto f0 = cancel_partials(state, state->candidate_bins[best], &energies[num_pitches]);
+        found[num_pitches] = best;
+        frequencies[num_pitches] = (float)(f0 * state->bin_frequency);
+        ++num_pitches;
+    }
+
+    // The confidence of each pitch is the energy it explains against what
+    // none of them explain
+    float residual_energy = 0.0f;
+    for (int k = 0; k < num_bins; ++k) {
+        residual_energy += residual[k] * residual[k];
+    }
+
+    result->num_pitches = num_pitches;
+    for (int i = 0; i < num_pitches; ++i) {
+        auto confidence = energies[i] / (energies[i] + residual_energy);
+        pitch_detect_set_result(&result->pitches[i], state->sample_rate / frequencies[i], state->sample_rate, confidence);
+    }
+}
+
+void poly_pitch_destroy(PolyPitchState* state) {
+    fft_destroy(state->fft_state);
+    delete[] state->spectrum;
+    delete[] state->residual;
+    delete[] state->candidate_bins;
+    delete[] state->salience;
+}
@@ -0,0 +1,52 @@
+#ifndef poly_pitch_hpp
+#define poly_pitch_hpp
+
+#include "fft.hpp"
+#include "pitch_detect.hpp"
+
+// Multi-pitch estimation for chords and double stops. Every candidate f0
+// (on a POLY_PITCH_RESOLUTION cent grid) is scored by the weighted sum of
+// the spectral peaks at its harmonics. The best one is taken, its partials
+// are cancelled from the spectrum (smoothed across neighbouring partials,
+// so partials shared with other notes are only partly removed), and the
+// search repeats until nothing salient is left or max_pitches are found.
+//
+// The spectrum needs to resolve the lowest partials, so this wants longer
+// windows than pitch_detect (e.g. 0.1 s for guitar, more for low piano).
+
+constexpr int POLY_PITCH_MAX_PITCHES = 6;
+constexpr int POLY_PITCH_HARMONICS = 12;
+constexpr double POLY_PITCH_RESOLUTION = 10.0; // cents
+
+struct PolyPitchResult {
+    int num_pitches;
+    PitchDetectResult pitches[POLY_PITCH_MAX_PITCHES]; // strongest first
+};
+
+struct PolyPitchState {
+    double window_time;
+    int sample_rate;
+    int window_length;
+    int num_bins;
+    double bin_frequency;
+    int partial_width; // half width of a partial's main lobe, in bins
+    int max_pitches;
+
+    FFTState* fft_state;
+    float* spectrum;      // magnitudes of the window
+    float* residual;      // what is left after cancelling the pitches found
+    int num_candidates;
+    float* candidate_bins; // f0 of each candidate, in bins
+    float* salience;
+};
+
+// The candidates span min_frequency...max_frequency, which (unlike
+// pitch_detect's range) can't be left open: 0 < min_frequency <
+// max_frequency is asserted.
+void poly_pitch_init(PolyPitchState* state, double window_time, int sample_rate, double min_frequency = 60.0, double max_frequency = 2000.0, int max_pitches = POLY_PITCH_MAX_PITCHES, FFTPrecision precision = FFT_PRECISION_FLOAT);
+
+// spectrum_out is the magnitude spectrum of the window
+void poly_pitch_compute(PolyPitchState* state, Area window_in, Area* spectrum_out, PolyPitchResult* result);
+void poly_pitch_destroy(PolyPitchState* state);
+
+#endif
@@ -1,67 +1,164 @@
 #include "window_reader.hpp"
-#include <atomic>
-#include <pthread.h>
 
-static double window_time;
-static int sample_rate;
-static int window_length;
+static void* window_reader_thread(void* ptr);
 
-static RingBufferState* ring_buffer;
-static RingBufferReaderState ring_buffer_reader;
-static window_callback_t callback;
+void window_reader_init(WindowReaderState* state, RingBufferState* ring_buffer, double window_time, double hop_time, int sample_rate, window_callback_t callback, void* user_data) {
 
-static float* window_data;
-static pthread_t thread;
-static std::atomic_bool running;
+    state->window_time = window_time;
+    state->hop_time = hop_time;
+    state->sample_rate = sample_rate;
+    state->window_length = (int)(window_time * sample_rate);
+    state->hop_length = (int)(hop_time * sample_rate);
+    if (state->hop_length < 1) {
+        state->hop_length = 1;
+    }
+    if (state->hop_length > state->window_length) {
+        state->hop_length = state->window_length;
+    }
 
-static void* window_reader_thread(void* ptr);
+    state->ring_buffer = ring_buffer;
+    ring_buffer_reader_init(ring_buffer, &state->ring_buffer_reader);
 
-void window_reader_init(RingBufferState* ring_buffer_, double window_time_, int sample_rate_, window_callback_t callback_) {
+    state->callback = callback;
+    state->user_data = user_data;
 
-    window_time = window_time_;
-    sample_rate = sample_rate_;
-    window_length = (int)(window_time * sample_rate);
+    state->zero_copy = ring_buffer->format == SAMPLE_FORMAT_FLOAT32 && ring_buffer->step == 1;
+    state->window_in_ring = false;
+    state->window_start = 0;
+    state->overwritten_windows = 0;
 
-    ring_buffer = ring_buffer_;
-    ring_buffer_reader_init(ring_buffer, &ring_buffer_reader);
+    state->window_data = new float[2 * state->window_length];
+    state->window_pos = 0;
 
-    callback = callback_;
+    state->running = false;
+}
 
-    window_data = new float[window_length * ring_buffer->step];
+bool window_reader_window_intact(WindowReaderState* state) {
+    return !state->window_in_ring || ring_buffer_span_intact(state->ring_buffer, state->window_start, state->window_length);
 }
 
-void window_reader_start() {
-    pthread_create(&thread, NULL, window_reader_thread, NULL);
+long window_reader_overwritten_windows(WindowReaderState* state) {
+    return state->overwritten_windows.load();
 }
 
-void window_reader_stop() {
-    if (running) {
-        running = false;
-        pthread_join(thread, NULL);
+void window_reader_start(WindowReaderState* state) {
+    state->running = true;
+    pthread_create(&state->thread, NULL, window_reader_thread, state);
+}
+
+void window_reader_stop(WindowReaderState* state) {
+    if (state->running) {
+        state->running = false;
+        pthread_join(state->thread, NULL);
     }
 }
 
-void window_reader_destroy() {
-    delete[] window_data;
+void window_reader_destroy(WindowReaderState* state) {
+    delete[] state->window_data;
+}
+
+// Returns false if we were stopped before all samples arrived
+static bool read_samples(WindowReaderState* state, int num_samples) {
+    auto ring_buffer = state->ring_buffer;
+    auto rbr = &state->ring_buffer_reader;
+    auto window_length = state->window_length;
+
+    // After an overrun the samples in the window are no longer contiguous,
+    // so start over with a whole new window
+    auto lost_samples = ring_buffer_reader_lost_samples(rbr);
+
+    // Wake up now and then to notice window_reader_stop
+    constexpr double READ_TIMEOUT = 0.1;
+
+    while (num_samples > 0 && state->zero_copy) {
+
+        // Just move past the samples, the window is taken from the ring
+        Area ptr_in;
+        if (!ring_buffer_timed_read(ring_buffer, rbr, num_samples, READ_TIMEOUT, &ptr_in)) {
+            if (!state->running.load()) {
+                return false;
+            }
+            continue;
+        }
+        if (ring_buffer_reader_lost_samples(rbr) != lost_samples) {
+            lost_samples = ring_buffer_reader_lost_samples(rbr);
+            num_samples = window_length;
+        }
+        num_samples -= ptr_in.num_samples();
+    }
+
+    while (num_samples > 0) {
+
+        // Convert straight into the window, up to its end at a time
+        auto window_pos = state->window_pos;
+        auto run_length = num_samples < window_length - window_pos ? num_samples : window_length - window_pos;
+        auto run = Area(state->window_data + window_pos, run_length, 1);
+        if (!ring_buffer_timed_read_convert(ring_buffer, rbr, run_length, READ_TIMEOUT, 1, &run)) {
+            if (!state->running.load()) {
+                return false;
+            }
+            continue;
+        }
+        if (ring_buffer_reader_lost_samples(rbr) != lost_samples) {
+            lost_samples = ring_buffer_reader_lost_samples(rbr);
+            num_samples = window_length;
+        }
+        num_samples -= run_length;
+
+        Area::copy_over(run, Area(state->window_data + window_pos + window_length, run_length, 1));
+        window_pos += run_length;
+        state->window_pos = window_pos == window_length ? 0 : window_pos;
+    }
+    return true;
 }
 
 void* window_reader_thread(void* ptr) {
-    running = true;
+    auto state = (WindowReaderState*)ptr;
+    auto window_length = state->window_length;
+
+    // The reader is registered only while this thread reads through it
+    ring_buffer_register_reader(state->ring_buffer, &state->ring_buffer_reader);
 
-    while (running.load()) {
+    // Fill the first window
+    auto filled = read_samples(state, window_length);
 
-        // Read in a new window
-        auto window = Area(window_data, window_length, ring_buffer->step);
-        auto ptr_out = window;
-        while (ptr_out < ptr_out.end) {
-            auto ptr_in = ring_buffer_read(ring_buffer, &ring_buffer_reader, ptr_out.num_samples());
-            while (ptr_in < ptr_in.end) {
-                *ptr_out++ = *ptr_in++;
+    while (filled && state->running.load()) {
+
+        state->window_start = state->ring_buffer_reader.read_point - window_length;
+
+        Area window;
+        state->window_in_ring = state->zero_copy && ring_buffer_peek(state->ring_buffer, state->window_start, window_length, 1, &window);
+
+        if (!state->zero_copy) {
+            window = Area(state->window_data + state->window_pos, window_length, 1);
+        } else if (!state->window_in_ring) {
+
+            // It wraps around the end of the buffer (or was overwritten
+            // already), so put it together in window_data
+            RingBufferReaderState rbr;
+            ring_buffer_reader_init_at(&rbr, state->window_start, RING_BUFFER_FAIL);
+            window = Area(state->window_data, window_length, 1);
+            if (!ring_buffer_timed_read_convert(state->ring_buffer, &rbr, window_length, 0.0, 1, &window)) {
+                ++state->overwritten_windows;
+                if (!read_samples(state, window_length)) {
+                    break;
+                }
+                continue;
             }
         }
 
-        callback(window, ring_buffer_reader - window.num_samples());
+        state->callback(state->user_data, window, state->window_start);
+
+        if (!window_reader_window_intact(state)) {
+            ++state->overwritten_windows;
+        }
+
+        // Slide forward by one hop
+        if (!read_samples(state, state->hop_length)) {
+            break;
+        }
     }
 
+    ring_buffer_unregister_reader(state->ring_buffer, &state->ring_buffer_reader);
     return NULL;
 }
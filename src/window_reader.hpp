@@ -1,13 +1,56 @@
 #ifndef window_reader_hpp
 #define window_reader_hpp
 
+#include <atomic>
+#include <pthread.h>
 #include "data_types/Area.hpp"
 #include "data_types/ring_buffer.hpp"
 
-typedef void (*window_callback_t)(Area window, long start_count);
-void window_reader_init(RingBufferState* ring_buffer, double window_time, int sample_rate, window_callback_t callback);
-void window_reader_start();
-void window_reader_stop();
-void window_reader_destroy();
+// Windows of window_time are delivered every hop_time, so consecutive
+// windows overlap when hop_time < window_time. Every reader has its own
+// thread and ring buffer reader, so several can run side by side on the
+// same ring buffer (e.g. short onset windows next to long pitch windows).
+typedef void (*window_callback_t)(void* user_data, Area window, long start_count);
+
+struct WindowReaderState {
+    double window_time;
+    double hop_time;
+    int sample_rate;
+    int window_length;
+    int hop_length;
+
+    RingBufferState* ring_buffer;
+    RingBufferReaderState ring_buffer_reader;
+    window_callback_t callback;
+    void* user_data;
+
+    // Windows of a float, step 1 ring buffer are handed out in place, as
+    // long as they don't wrap around the end of a heap buffer
+    bool zero_copy;
+    bool window_in_ring; // the current window points into the ring
+    long window_start;
+    std::atomic_long overwritten_windows;
+
+    // Otherwise every sample is written twice, window_length apart, so the
+    // latest window_length samples are always contiguous at window_data +
+    // window_pos and each hop only copies the new samples
+    float* window_data;
+    int window_pos;
+
+    pthread_t thread;
+    std::atomic_bool running;
+};
+
+void window_reader_init(WindowReaderState* state, RingBufferState* ring_buffer, double window_time, double hop_time, int sample_rate, window_callback_t callback, void* user_data = NULL);
+void window_reader_start(WindowReaderState* state);
+void window_reader_stop(WindowReaderState* state);
+void window_reader_destroy(WindowReaderState* state);
+
+// Windows are passed straight out of the ring buffer when it stores float
+// samples with step 1, so the writer can overwrite one while the callback
+// still works on it (only if the analysis falls a whole ring behind). The
+// callback can check with window_reader_window_intact once it's done.
+bool window_reader_window_intact(WindowReaderState* state);
+long window_reader_overwritten_windows(WindowReaderState* state);
 
 #endif
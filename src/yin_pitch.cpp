@@ -0,0 +1,181 @@
+#include "yin_pitch.hpp"
+#include "kernels.hpp"
+#include <cmath>
+
+// Samples are pushed in blocks of up to PUSH_BLOCK, and each lag is then
+// updated with one pass over the block
+constexpr int PUSH_BLOCK = 256;
+
+// Rounding errors pile up in the sliding sums, so every so often d is
+// recomputed from scratch
+constexpr int RECOMPUTE_WINDOWS = 16;
+
+void yin_pitch_init(YinPitchState* state, double window_time, int sample_rate, double min_frequency, double max_frequency, float threshold) {
+
+    state->sample_rate = sample_rate;
+    state->window_length = (int)(window_time * sample_rate);
+    state->threshold = threshold;
+
+    state->min_lag = max_frequency > 0.0 ? (int)floor(sample_rate / max_frequency) - 1 : 2;
+    state->max_lag = min_frequency > 0.0 ? (int)ceil(sample_rate / min_frequency) + 1 : state->window_length / 2;
+    if (state->min_lag < 2) {
+        state->min_lag = 2;
+    }
+    if (state->max_lag > state->window_length - 1) {
+        state->max_lag = state->window_length - 1;
+    }
+
+    state->history_length = state->window_length + state->max_lag + PUSH_BLOCK;
+    state->history = new float[2 * state->history_length];
+    state->difference = new double[state->max_lag + 1];
+    state->cmndf = new float[state->max_lag + 1];
+
+    state->end_count = 0;
+    yin_pitch_reset(state);
+}
+
+void yin_pitch_reset(YinPitchState* state) {
+    for (int i = 0; i < 2 * state->history_length; ++i) {
+        state->history[i] = 0.0f;
+    }
+    for (int t = 0; t <= state->max_lag; ++t) {
+        state->difference[t] = 0.0;
+    }
+    state->history_pos = 0;
+    state->num_samples = 0;
+    state->since_recompute = 0;
+}
+
+static void recompute(YinPitchState* state) {
+    auto window_length = state->window_length;
+    auto first = state->history + state->history_pos + state->history_length - window_length;
+
+    state->difference[0] = 0.0;
+    for (int t = 1; t <= state->max_lag; ++t) {
+        double sum = 0.0;
+        for (int j = 0; j < window_length; ++j) {
+            auto a = first[j] - first[j - t];
+            sum += a * a;
+        }
+        state->difference[t] = sum;
+    }
+    state->since_recompute = 0;
+}
+
+void yin_pitch_push(YinPitchState* state, Area in) {
+    auto history_length = state->history_length;
+    auto window_length = state->window_length;
+    auto max_lag = state->max_lag;
+    auto difference = state->difference;
+    auto num_samples = in.num_samples();
+
+    while (in < in.end) {
+        auto block_length = in.num_samples() < PUSH_BLOCK ? in.num_samples() : PUSH_BLOCK;
+        for (int i = 0; i < block_length; ++i, ++in) {
+            auto x = *in;
+            state->history[state->history_pos] = x;
+            state->history[state->history_pos + history_length] = x;
+            if (++state->history_pos == history_length) {
+                state->history_pos = 0;
+            }
+        }
+
+        // The block entered the window and the block_length samples
+        // window_length before it left
+        auto entering = state->history + state->history_pos + history_length - block_length;
+        auto leaving = entering - window_length;
+        for (int t = 1; t <= max_lag; ++t) {
+            difference[t] += sliding_difference(entering, entering - t, leaving, leaving - t, block_length);
+        }
+    }
+
+    state->num_samples += num_samples;
+    state->end_count += num_samples;
+    state->since_recompute += num_samples;
+    if (state->since_recompute >= RECOMPUTE_WINDOWS * window_length && state->num_samples >= window_length + max_lag) {
+        recompute(state);
+    }
+}
+
+void yin_pitch_compute(YinPitchState* state, Area* window_out, PitchDetectResult* result) {
+    auto d = state->difference;
+    auto cmndf = state->cmndf;
+    auto max_lag = state->max_lag;
+    *window_out = Area(cmndf, max_lag + 1, 1);
+
+    if (state->num_samples < state->window_length + max_lag) {
+        for (int t = 0; t <= max_lag; ++t) {
+            cmndf[t] = 1.0f;
+        }
+        pitch_detect_set_result(result, 0.0f, state->sample_rate, 0.0f);
+        return;
+    }
+
+    // d'(t) = d(t) / ((1 / t) * sum of d(1...t))
+    cmndf[0] = 1.0f;
+    double sum = 0.0;
+    for (int t = 1; t <= max_lag; ++t) {
+        sum += d[t];
+        cmndf[t] = sum > 0.0 ? (float)(d[t] * t / sum) : 1.0f;
+    }
+
+    // The first dip under the threshold, followed down to its minimum. If
+    // nothing is under the threshold take the lowest point overall.
+    auto min_t = state->min_lag;
+    int best = 0;
+    for (int t = min_t; t <= max_lag; ++t) {
+        if (cmndf[t] < state->threshold) {
+            while (t + 1 <= max_lag && cmndf[t + 1] < cmndf[t]) {
+                ++t;
+            }
+            best = t;
+            break;
+        }
+    }
+    if (best == 0) {
+        best = min_t;
+        for (int t = min_t; t <= max_lag; ++t) {
+            if (cmndf[t] < cmndf[best]) {
+                best = t;
+            }
+        }
+    }
+
+    // Parabolic interpolation around the minimum
+    float period = (float)best;
+    float value = cmndf[best];
+    if (best > min_t && best < max_lag) {
+        period += parabolic_vertex(cmndf[best - 1], cmndf[best], cmndf[best + 1], &value);
+    }
+
+    // Silence (or noise) has no dip at all
+    auto confidence = 1.0f - value;
+    if (confidence <= 0.0f) {
+        pitch_detect_set_result(result, 0.0f, state->sample_rate, 0.0f);
+        return;
+    }
+    if (confidence > 1.0f) {
+        confidence = 1.0f;
+    }
+    pitch_detect_set_result(result, period, state->sample_rate, confidence);
+}
+
+void yin_pitch_detect(YinPitchState* state, Area window, long start_count, Area* window_out, PitchDetectResult* result) {
+    auto window_end = start_count + window.num_samples();
+
+    // After a gap (or going back) the history no longer lines up
+    if (start_count > state->end_count || window_end < state->end_count) {
+        yin_pitch_reset(state);
+        state->end_count = start_count;
+    }
+
+    auto fresh = window + (int)(state->end_count - start_count);
+    yin_pitch_push(state, fresh);
+    yin_pitch_compute(state, window_out, result);
+}
+
+void yin_pitch_destroy(YinPitchState* state) {
+    delete[] state->history;
+    delete[] state->difference;
+    delete[] state->cmndf;
+}
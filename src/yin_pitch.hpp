@@ -0,0 +1,56 @@
+#ifndef yin_pitch_hpp
+#define yin_pitch_hpp
+
+#include "data_types/Area.hpp"
+#include "pitch_detect.hpp"
+
+// YIN pitch detection with a sliding difference function. Instead of
+// recomputing it for every window, d(t) is updated for each new sample by
+// adding the term entering the window and subtracting the one leaving it,
+// so an estimate every hop costs hop * max_lag rather than a full
+// autocorrelation. Memory is bounded by window_length + max_lag samples
+// (plus one block of pushed samples).
+
+constexpr float YIN_THRESHOLD = 0.1f;
+
+struct YinPitchState {
+    int sample_rate;
+    int window_length;
+    int min_lag;
+    int max_lag;
+    float threshold;
+
+    // The latest history_length samples, written twice so they're always
+    // contiguous at history + history_pos
+    int history_length;
+    float* history;
+    int history_pos;
+    long num_samples;     // pushed since the last reset
+    long end_count;       // absolute index after the last sample pushed
+    long since_recompute; // samples since d was last computed from scratch
+
+    double* difference; // d(t), summed over the latest window_length samples
+    float* cmndf;       // cumulative mean normalised difference, d'(t)
+};
+
+// min_frequency and max_frequency limit the lags searched as in
+// pitch_detect_init_state (by default up to half the window)
+void yin_pitch_init(YinPitchState* state, double window_time, int sample_rate, double min_frequency = 0.0, double max_frequency = 0.0, float threshold = YIN_THRESHOLD);
+
+// Appends samples to the stream, updating the difference function
+void yin_pitch_push(YinPitchState* state, Area in);
+void yin_pitch_reset(YinPitchState* state);
+
+// Estimates the pitch of the latest window_length samples. window_out is
+// d'(t) for the lags 0...max_lag. The result is empty until window_length
+// + max_lag samples have been pushed.
+void yin_pitch_compute(YinPitchState* state, Area* window_out, PitchDetectResult* result);
+
+// For window reader callbacks: pushes only the samples of window (which
+// starts at start_count) that weren't pushed before, then computes.
+// Overlapping windows therefore only cost their hop.
+void yin_pitch_detect(YinPitchState* state, Area window, long start_count, Area* window_out, PitchDetectResult* result);
+
+void yin_pitch_destroy(YinPitchState* state);
+
+#endif